@@ -0,0 +1,434 @@
+/*
+ * Benchmark of the core routines of iomenu, run headlessly on the corpus
+ * read from stdin, which has to be a regular file.  Each result is printed
+ * as one line of JSON on stdout.
+ *
+ * The scripts typed are given with -k, one per option, with '<' standing
+ * for Backspace, '^' for Ctrl+U and '~' for Ctrl+W; every key is filtered
+ * to the end before the next one, and timed.
+ *
+ * With -m, the variants of the substring search are checked against
+ * strcasestr() and timed instead, without reading stdin.
+ */
+
+#define main iomenu_main
+#include "iomenu.c"
+#undef main
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define BENCH_SCRIPTS 32
+
+static char const *bench_name = "stdin";
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+bench_cmp(void const *a, void const *b)
+{
+	double x = *(double const *)a, y = *(double const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Print the percentiles of the `count' times of `t', in milliseconds.
+ */
+static void
+bench_percentiles(double *t, size_t count)
+{
+	qsort(t, count, sizeof *t, bench_cmp);
+	printf(", \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f"
+	  ", \"max_ms\": %.3f", t[count * 50 / 100] * 1e3,
+	  t[count * 90 / 100] * 1e3, t[count * 99 / 100] * 1e3,
+	  t[count - 1] * 1e3);
+}
+
+static void
+bench_begin(char const *bench)
+{
+	printf("{\"corpus\": \"%s\", \"bench\": \"%s\", \"lines\": %zu"
+	  ", \"bytes\": %zu", bench_name, bench, ctx.lines_count, ctx.in.len);
+}
+
+static void
+bench_end(void)
+{
+	printf("}\n");
+	fflush(stdout);
+}
+
+/*
+ * Read the whole of stdin by blocks, as when it is a pipe.
+ */
+static void
+bench_read(void)
+{
+	double t = bench_now();
+
+	while (!ctx.eof)
+		read_stdin();
+	t = bench_now() - t;
+
+	bench_begin("read");
+	printf(", \"ms\": %.3f, \"mb_per_s\": %.1f, \"lines_per_s\": %.0f",
+	  t * 1e3, ctx.in.len / t / 1e6, ctx.lines_count / t);
+	bench_end();
+}
+
+/*
+ * Index the lines read, as at the end of the input with -i.
+ */
+static void
+bench_index(void)
+{
+	double t = bench_now();
+
+	opt_index = 1;
+	update_lines();
+	t = bench_now() - t;
+
+	bench_begin("index");
+	printf(", \"ms\": %.3f, \"mb_per_s\": %.1f, \"index_bytes\": %zu",
+	  t * 1e3, ctx.in.len / t / 1e6, index_size(&ctx.index));
+	bench_end();
+}
+
+/*
+ * Map stdin and split it in lines, as when it is a regular file.
+ */
+static void
+bench_map(void)
+{
+	struct input in = {0};
+	double t = bench_now();
+
+	if (input_map(&in, STDIN_FILENO) <= 0 || input_end(&in) < 0)
+		die("mapping standard input");
+	t = bench_now() - t;
+
+	bench_begin("map");
+	printf(", \"ms\": %.3f, \"mb_per_s\": %.1f, \"lines_per_s\": %.0f",
+	  t * 1e3, in.len / t / 1e6, in.lines_count / t);
+	bench_end();
+
+	munmap(in.buf, in.len);
+	free(in.fold);
+	free(in.offs);
+	free(in.lens);
+}
+
+/*
+ * Type the keys of the script, filtering all of the lines after each.
+ */
+static void
+bench_keys(char const *script)
+{
+	size_t count = strlen(script), len, i;
+	double *t, total = 0;
+
+	if (count == 0)
+		return;
+	t = xmalloc(count * sizeof *t);
+
+	ctx.input[0] = '\0';
+	do_filter();
+	while (filter_pending())
+		filter_step();
+
+	for (i = 0; i < count; i++) {
+		t[i] = bench_now();
+		switch (script[i]) {
+		case '<':
+			if ((len = strlen(ctx.input)) > 0)
+				ctx.input[len - 1] = '\0';
+			do_filter();
+			break;
+		case '^':
+			ctx.input[0] = '\0';
+			do_filter();
+			break;
+		case '~':
+			do_remove_word();
+			break;
+		default:
+			do_add_char(script[i]);
+		}
+		while (filter_pending())
+			filter_step();
+		t[i] = bench_now() - t[i];
+		total += t[i];
+	}
+
+	bench_begin("keys");
+	printf(", \"script\": \"");
+	for (char const *s = script; *s != '\0'; s++)
+		printf(*s == '"' || *s == '\\' ? "\\%c" : "%c", *s);
+	printf("\", \"keys\": %zu, \"matches\": %zu, \"ms\": %.3f", count,
+	  ctx.match_count, total * 1e3);
+	bench_percentiles(t, count);
+	bench_end();
+	free(t);
+}
+
+/*
+ * Measure all of the lines for a screen of `cols' columns.
+ */
+static void
+bench_width(int cols)
+{
+	double t = bench_now();
+	volatile size_t sum = 0;
+
+	for (size_t n = 0; n < ctx.lines_count; n++)
+		sum += term_at_width(line_str(n), ctx.lines_len[n], cols, 0);
+	t = bench_now() - t;
+
+	bench_begin("width");
+	printf(", \"cols\": %d, \"ms\": %.3f, \"mb_per_s\": %.1f"
+	  ", \"lines_per_s\": %.0f", cols, t * 1e3, ctx.in.len / t / 1e6,
+	  ctx.lines_count / t);
+	bench_end();
+}
+
+/*
+ * Draw `count' full frames of all the lines, one page after the other,
+ * to /dev/null.
+ */
+static void
+bench_render(int rows, int cols, size_t count)
+{
+	double *t;
+	int null, err;
+
+	if ((null = open("/dev/null", O_WRONLY)) == -1
+	  || (err = dup(STDERR_FILENO)) == -1
+	  || dup2(null, STDERR_FILENO) == -1)
+		die("opening /dev/null");
+	t = xmalloc(count * sizeof *t);
+
+	ctx.input[0] = '\0';
+	do_filter();
+	while (filter_pending())
+		filter_step();
+	term.winsize.ws_row = rows;
+	term.winsize.ws_col = cols;
+
+	for (size_t i = 0; i < count; i++) {
+		t[i] = bench_now();
+		term.redraw = 1;
+		do_print_screen();
+		t[i] = bench_now() - t[i];
+		if (ctx.cur + rows - 1 >= ctx.match_count)
+			ctx.cur = 0;
+		else
+			do_move_page(+1);
+	}
+
+	dup2(err, STDERR_FILENO);
+	close(err);
+	close(null);
+
+	bench_begin("render");
+	printf(", \"rows\": %d, \"cols\": %d, \"frames\": %zu", rows, cols,
+	  count);
+	bench_percentiles(t, count);
+	bench_end();
+	free(t);
+}
+
+/*
+ * Bytes of the random strings searched by bench_match(), letters and the
+ * bytes that differ from them or from each other by the 0x20 case bit.
+ */
+static char const bench_bytes[] = "aAzZbB@`[{^~?_";
+
+static void
+bench_random(char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		s[i] = bench_bytes[rand() % (sizeof bench_bytes - 1)];
+	s[len] = '\0';
+}
+
+/*
+ * Best time of a few searches of a token absent from `s', with the current
+ * variant, or with strcasestr() if `len' is 0.
+ */
+static double
+bench_match_time(char const *s, size_t len)
+{
+	double t, best = 0;
+
+	for (int i = 0; i < 5; i++) {
+		t = bench_now();
+		if ((len > 0 ? match_memcasemem(s, len, "Exit", 4)
+		  : strcasestr(s, "Exit")) != NULL)
+			die("searching");
+		t = bench_now() - t;
+		if (i == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+/*
+ * Check every variant of the substring search the CPU supports against
+ * strcasestr() and strstr() on random strings of every length of tail after
+ * the blocks of 16 and 32 bytes, then time each over a large string.
+ */
+static void
+bench_match(void)
+{
+	enum { BENCH_MATCH_LEN = 16 << 20, BENCH_MATCH_ROUNDS = 20000 };
+	char *big, s[256 + 1], tok[8 + 1];
+	char const *name, *want, *got;
+	size_t len, toklen, checks;
+	double t;
+
+	/* text where the token is never found, its first byte often is */
+	big = xmalloc(BENCH_MATCH_LEN + 1);
+	for (size_t i = 0; i < BENCH_MATCH_LEN; i++)
+		big[i] = "etaoin shrdlu/"[rand() % 14];
+	big[BENCH_MATCH_LEN] = '\0';
+
+	for (int v = 0; (name = match_use(v)) != NULL; v++) {
+		srand(1);
+		checks = 0;
+		for (int r = 0; r < BENCH_MATCH_ROUNDS; r++) {
+			len = r % 64 + rand() % 4 * 64;
+			toklen = 1 + rand() % (sizeof tok - 1);
+			bench_random(s, len);
+			if (len >= toklen && rand() % 2) {
+				memcpy(tok, s + rand() % (len - toklen + 1), toklen);
+				tok[rand() % toklen] ^= 0x20;
+				tok[toklen] = '\0';
+			} else {
+				bench_random(tok, toklen);
+			}
+			want = strcasestr(s, tok);
+			got = match_memcasemem(s, len, tok, toklen);
+			if (got != want) {
+				fprintf(stderr, "%s: \"%s\" in \"%s\": %td, not %td\n",
+				  name, tok, s, got ? got - s : -1,
+				  want ? want - s : -1);
+				exit(1);
+			}
+			/* folded first, as match_memmem() expects */
+			for (char *c = s; *c != '\0'; c++)
+				*c = tolower((unsigned char)*c);
+			for (char *c = tok; *c != '\0'; c++)
+				*c = tolower((unsigned char)*c);
+			want = strstr(s, tok);
+			got = match_memmem(s, len, tok, toklen);
+			if (got != want) {
+				fprintf(stderr, "%s: \"%s\" in \"%s\" folded: %td, "
+				  "not %td\n", name, tok, s, got ? got - s : -1,
+				  want ? want - s : -1);
+				exit(1);
+			}
+			checks += 2;
+		}
+
+		t = bench_match_time(big, BENCH_MATCH_LEN);
+		printf("{\"bench\": \"match\", \"variant\": \"%s\""
+		  ", \"checks\": %zu, \"gb_per_s\": %.2f}\n", name, checks,
+		  BENCH_MATCH_LEN / t / 1e9);
+	}
+	t = bench_match_time(big, 0);
+	printf("{\"bench\": \"match\", \"variant\": \"strcasestr\""
+	  ", \"gb_per_s\": %.2f}\n", BENCH_MATCH_LEN / t / 1e9);
+	fflush(stdout);
+	free(big);
+	match_init();
+}
+
+static void
+bench_usage(char const *arg0)
+{
+	fprintf(stderr, "usage: %s [-efi] [-j jobs] [-n name] [-k keys]... "
+	  "<file\n       %s -m\n", arg0, arg0);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char const *scripts[BENCH_SCRIPTS];
+	struct rusage ru;
+	size_t nscripts = 0;
+	int index = 0;
+
+	opt_jobs = 1;
+	for (int opt; (opt = getopt(argc, argv, "efij:k:mn:")) > 0;) {
+		switch (opt) {
+		case 'e':
+			opt_regex = 1;
+			break;
+		case 'f':
+			opt_fuzzy = 1;
+			break;
+		case 'i':
+			index = 1;
+			break;
+		case 'j':
+			opt_jobs = atoi(optarg);
+			if (opt_jobs < 1 || opt_jobs > POOL_MAX)
+				bench_usage(argv[0]);
+			break;
+		case 'k':
+			if (nscripts == BENCH_SCRIPTS)
+				bench_usage(argv[0]);
+			scripts[nscripts++] = optarg;
+			break;
+		case 'm':
+			bench_match();
+			return 0;
+		case 'n':
+			bench_name = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+		}
+	}
+	if (opt_regex) {
+		opt_fuzzy = index = 0;
+		if (pattern_compile(&ctx.pattern, "", 0) < 0)
+			die("compiling the pattern");
+	}
+	if (opt_fuzzy) {
+		index = 0;
+		opt_rank = 1;
+		ctx.top = xmalloc(RANK_TOP * sizeof *ctx.top);
+	}
+	if (pool_init(opt_jobs) < 0)
+		die("starting threads");
+	match_init();
+
+	bench_read();
+	if (index)
+		bench_index();
+	if (lseek(STDIN_FILENO, 0, SEEK_SET) == -1)
+		die("rewinding standard input");
+	bench_map();
+
+	for (size_t i = 0; i < nscripts; i++)
+		bench_keys(scripts[i]);
+	bench_width(80);
+	bench_width(200);
+	bench_render(50, 200, 1000);
+
+	getrusage(RUSAGE_SELF, &ru);
+	bench_begin("rss");
+	printf(", \"max_rss_kb\": %ld", ru.ru_maxrss);
+	bench_end();
+	return 0;
+}
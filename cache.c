@@ -0,0 +1,221 @@
+#include "cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Image of the lines of a file, of their index if there is one, and of the
+ * file folded to lowercase if folding changes it, kept in a directory with one file per input file, named after its device and inode
+ * numbers.  It is only used if the size and modification time of the input
+ * file are still those it had when it was written.
+ *
+ * The image is the header followed by the arrays as they are in memory, so
+ * that it is used in place once mapped, and only by the same build of the
+ * program on the same machine.
+ */
+
+#define CACHE_MAGIC "iomenu\0\5"
+
+struct cache_header {
+	char magic[8];
+	uint64_t word_size, index_bits;
+	uint64_t dev, ino, size, mtime_sec, mtime_nsec;
+	uint64_t lines_count, posts_len, fold_len;
+	uint64_t unique, dup_count;
+};
+
+/*
+ * Size of the lengths of the lines in the image, padded for the array
+ * after it to be aligned.
+ */
+static size_t
+cache_lens_size(size_t count)
+{
+	return (count * sizeof(uint32_t) + sizeof(size_t) - 1)
+	  / sizeof(size_t) * sizeof(size_t);
+}
+
+static int
+cache_path(char *path, size_t sz, char const *dir, struct stat const *st)
+{
+	int len;
+
+	len = snprintf(path, sz, "%s/%jx-%jx", dir,
+	  (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+	if (len < 0 || (size_t)len >= sz) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+cache_header_set(struct cache_header *h, struct stat const *st)
+{
+	memset(h, 0, sizeof *h);
+	memcpy(h->magic, CACHE_MAGIC, sizeof h->magic);
+	h->word_size = sizeof(size_t);
+	h->dev = st->st_dev;
+	h->ino = st->st_ino;
+	h->size = st->st_size;
+	h->mtime_sec = st->st_mtim.tv_sec;
+	h->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/*
+ * Map the image of the file described by `st' if there is an up to date
+ * one in `dir', with its lines kept as `unique' tells.  Return 1 if there
+ * is, 0 if there is not, -1 on error.
+ */
+int
+cache_load(struct cache *c, char const *dir, struct stat const *st,
+	int unique)
+{
+	struct cache_header want, *h;
+	struct stat cst;
+	char path[PATH_MAX], *p;
+	size_t need;
+	int fd;
+
+	if (cache_path(path, sizeof path, dir, st) < 0)
+		return -1;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : -1;
+	if (fstat(fd, &cst) == -1 || (uintmax_t)cst.st_size > SIZE_MAX
+	  || (size_t)cst.st_size < sizeof *h) {
+		close(fd);
+		return 0;
+	}
+	c->len = cst.st_size;
+	c->map = mmap(NULL, c->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (c->map == MAP_FAILED)
+		return -1;
+
+	h = c->map;
+	/* the counts are only read from an image of this build */
+	if (memcmp(h->magic, CACHE_MAGIC, sizeof h->magic) != 0
+	  || h->word_size != sizeof(size_t)
+	  || h->lines_count > c->len / sizeof *c->offs
+	  || h->posts_len > c->len
+	  || (h->fold_len != 0 && h->fold_len != h->size))
+		goto stale;
+	cache_header_set(&want, st);
+	want.index_bits = h->index_bits != 0 ? INDEX_BITS : 0;
+	want.lines_count = h->lines_count;
+	want.posts_len = h->posts_len;
+	want.fold_len = h->fold_len;
+	want.unique = unique;
+	want.dup_count = h->dup_count;
+	need = sizeof *h + h->lines_count * sizeof *c->offs
+	  + cache_lens_size(h->lines_count);
+	if (h->index_bits != 0)
+		need += (INDEX_BUCKETS + 1) * sizeof(size_t) + h->posts_len;
+	need += h->fold_len;
+	if (memcmp(h, &want, sizeof want) != 0 || need != c->len)
+		goto stale;
+
+	p = (char *)(h + 1);
+	c->offs = (size_t *)p;
+	p += h->lines_count * sizeof *c->offs;
+	c->lens = (uint32_t *)p;
+	p += cache_lens_size(h->lines_count);
+	c->lines_count = h->lines_count;
+	c->dup_count = h->dup_count;
+	c->index.offs = NULL;
+	c->index.posts = NULL;
+	c->index.lines_count = h->lines_count;
+	if (h->index_bits != 0) {
+		c->index.offs = (size_t *)p;
+		c->index.posts = (uint8_t *)(p + (INDEX_BUCKETS + 1)
+		  * sizeof *c->index.offs);
+		p += (INDEX_BUCKETS + 1) * sizeof *c->index.offs + h->posts_len;
+	}
+	c->fold = h->fold_len != 0 ? p : NULL;
+	return 1;
+
+stale:
+	cache_unmap(c);
+	return 0;
+}
+
+/*
+ * Unmap the image mapped by cache_load(), once its lines are not used.
+ */
+void
+cache_unmap(struct cache *c)
+{
+	munmap(c->map, c->len);
+}
+
+static int
+cache_write(int fd, void const *buf, size_t len)
+{
+	char const *s = buf;
+	ssize_t r;
+
+	for (; len > 0; s += r, len -= r) {
+		if ((r = write(fd, s, len)) == -1) {
+			if (errno != EINTR)
+				return -1;
+			r = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write the image of the lines of `in', and of their index `ix' if it is
+ * not NULL, for the file described by `st', creating `dir' if needed.
+ * It is written to a temporary file first, to never leave a partial image
+ * behind.
+ */
+int
+cache_save(char const *dir, struct stat const *st, struct input const *in,
+	struct index const *ix)
+{
+	struct cache_header h;
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	size_t const pad = 0;
+	int fd;
+
+	if (cache_path(path, sizeof path, dir, st) < 0)
+		return -1;
+	mkdir(dir, 0700);
+	snprintf(tmp, sizeof tmp, "%s.%ld", path, (long)getpid());
+
+	cache_header_set(&h, st);
+	h.index_bits = ix != NULL ? INDEX_BITS : 0;
+	h.lines_count = in->lines_count;
+	h.posts_len = ix != NULL ? ix->offs[INDEX_BUCKETS] : 0;
+	h.fold_len = in->fold != NULL ? in->fold_len : 0;
+	h.unique = in->unique;
+	h.dup_count = in->dup_count;
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+		return -1;
+	if (cache_write(fd, &h, sizeof h) < 0
+	  || cache_write(fd, in->offs, in->lines_count * sizeof *in->offs) < 0
+	  || cache_write(fd, in->lens, in->lines_count * sizeof *in->lens) < 0
+	  || cache_write(fd, &pad, cache_lens_size(in->lines_count)
+	  - in->lines_count * sizeof *in->lens) < 0
+	  || (ix != NULL && (cache_write(fd, ix->offs,
+	  (INDEX_BUCKETS + 1) * sizeof *ix->offs) < 0
+	  || cache_write(fd, ix->posts, h.posts_len) < 0))
+	  || cache_write(fd, in->fold, h.fold_len) < 0) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	if (close(fd) == -1 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "index.h"
+#include "input.h"
+
+struct cache {
+	void *map;
+	size_t len;
+
+	size_t *offs;
+	uint32_t *lens;
+	char *fold;
+	size_t lines_count, dup_count;
+	struct index index;
+};
+
+int	cache_load(struct cache *c, char const *dir, struct stat const *st,
+		  int unique);
+void	cache_unmap(struct cache *c);
+int	cache_save(char const *dir, struct stat const *st,
+		  struct input const *in, struct index const *ix);
+
+#endif
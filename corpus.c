@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Write `count' lines of a synthetic corpus of the given kind to stdout,
+ * for benchmarking: always the same for the same arguments.
+ *
+ *	paths	file paths, as from find(1)
+ *	ps	process list, as from ps(1), with a header line
+ *	log	syslog-like log lines
+ *	cjk	text mostly in Chinese and Japanese, with some ASCII
+ */
+
+static uint64_t corpus_state = 0x9e3779b97f4a7c15;
+
+static uint32_t
+corpus_rand(uint32_t n)
+{
+	corpus_state ^= corpus_state >> 12;
+	corpus_state ^= corpus_state << 25;
+	corpus_state ^= corpus_state >> 27;
+	return (corpus_state * 0x2545f4914f6cdd1d >> 32) % n;
+}
+
+#define PICK(a) ((a)[corpus_rand(sizeof (a) / sizeof *(a))])
+
+static char const *dirs[] = {
+	"usr", "lib", "share", "include", "src", "bin", "local", "home",
+	"var", "log", "cache", "etc", "doc", "man", "python3", "x86_64",
+	"node_modules", "build", "test", "internal", "vendor", "github.com",
+	"Documents", "Music", "Pictures", "Projects", ".config", "kernel",
+	"drivers", "net", "fs", "arch", "tools", "scripts", "assets", "icons",
+};
+
+static char const *names[] = {
+	"main", "index", "config", "README", "Makefile", "utils", "parser",
+	"server", "client", "test_main", "setup", "__init__", "LICENSE",
+	"CHANGELOG", "module", "handler", "view", "model", "controller",
+	"style", "app", "helpers", "types", "errors", "io", "string", "list",
+};
+
+static char const *exts[] = {
+	".c", ".h", ".py", ".js", ".ts", ".go", ".rs", ".md", ".txt",
+	".json", ".yml", ".html", ".css", ".png", ".svg", ".o", ".so", "",
+};
+
+static char const *cmds[] = {
+	"/usr/sbin/sshd -D", "/usr/bin/python3 -m http.server 8080",
+	"[kworker/0:1-events]", "/sbin/init splash", "bash", "-zsh",
+	"/usr/lib/firefox/firefox -contentproc -childID 12", "vim iomenu.c",
+	"/usr/bin/dbus-daemon --session --address=systemd:",
+	"node /usr/local/bin/npm run dev", "tmux new -s main", "less +F log",
+	"/usr/lib/systemd/systemd-journald", "cron -f", "top -d 1",
+};
+
+static char const *services[] = {
+	"sshd", "kernel", "systemd", "cron", "nginx", "postgres", "dhcpcd",
+	"NetworkManager", "dockerd", "su", "sudo", "smtpd", "ntpd",
+};
+
+static char const *levels[] = {
+	"info", "info", "info", "notice", "warning", "error", "debug",
+};
+
+static char const *words[] = {
+	"connection", "from", "accepted", "closed", "failed", "user", "for",
+	"session", "opened", "timeout", "request", "GET", "POST", "/api/v1",
+	"status", "200", "404", "500", "retrying", "in", "seconds", "disk",
+	"full", "started", "stopped", "Listening", "on", "port", "address",
+};
+
+static void
+corpus_path(void)
+{
+	int depth = 1 + corpus_rand(8);
+
+	for (int i = 0; i < depth; i++)
+		printf("/%s", PICK(dirs));
+	printf("/%s%s\n", PICK(names), PICK(exts));
+}
+
+static void
+corpus_ps(void)
+{
+	static char const *stats[] = { "S", "Ss", "R+", "I<", "Sl", "D" };
+
+	printf("%5u ?        %-4s %3u:%02u %s\n", corpus_rand(99999),
+	  PICK(stats), corpus_rand(999), corpus_rand(60), PICK(cmds));
+}
+
+static void
+corpus_log(uint64_t n)
+{
+	int count = 3 + corpus_rand(12);
+
+	printf("2026-%02d-%02dT%02u:%02u:%02u.%03uZ host%u %s[%u]: %s:",
+	  (int)(1 + n / 2678400 % 12), (int)(1 + n / 86400 % 28),
+	  corpus_rand(24), corpus_rand(60), corpus_rand(60),
+	  corpus_rand(1000), corpus_rand(16), PICK(services),
+	  corpus_rand(65536), PICK(levels));
+	for (int i = 0; i < count; i++)
+		printf(" %s", PICK(words));
+	printf("\n");
+}
+
+/*
+ * Encode one codepoint from the CJK Unified Ideographs, Hiragana and
+ * Katakana blocks, or an ASCII word now and then.
+ */
+static void
+corpus_cjk(void)
+{
+	int count = 5 + corpus_rand(40);
+
+	for (int i = 0; i < count; i++) {
+		uint32_t c;
+
+		switch (corpus_rand(8)) {
+		case 0:
+			printf(" %s ", PICK(words));
+			continue;
+		case 1:
+			c = 0x3041 + corpus_rand(0x56);
+			break;
+		case 2:
+			c = 0x30a1 + corpus_rand(0x5a);
+			break;
+		default:
+			c = 0x4e00 + corpus_rand(0x5200);
+		}
+		printf("%c%c%c", 0xe0 | c >> 12, 0x80 | (c >> 6 & 0x3f),
+		  0x80 | (c & 0x3f));
+	}
+	printf("\n");
+}
+
+static void
+usage(char const *arg0)
+{
+	fprintf(stderr, "usage: %s paths|ps|log|cjk count\n", arg0);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char const *kind;
+	uint64_t count;
+
+	if (argc != 3)
+		usage(argv[0]);
+	kind = argv[1];
+	count = strtoull(argv[2], NULL, 10);
+
+	if (strcmp(kind, "ps") == 0 && count > 0) {
+		printf("  PID TTY      STAT   TIME COMMAND\n");
+		count--;
+	}
+	for (uint64_t n = 0; n < count; n++) {
+		if (strcmp(kind, "paths") == 0)
+			corpus_path();
+		else if (strcmp(kind, "ps") == 0)
+			corpus_ps();
+		else if (strcmp(kind, "log") == 0)
+			corpus_log(n);
+		else if (strcmp(kind, "cjk") == 0)
+			corpus_cjk();
+		else
+			usage(argv[0]);
+	}
+	return fflush(stdout) == EOF;
+}
@@ -0,0 +1,139 @@
+#include "field.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fields of a line: either separated by every occurrence of a delimiter
+ * byte, or with FIELD_BLANKS, by runs of spaces and tabs, with the blanks
+ * at the start and end of the line ignored, as awk(1) does by default.
+ *
+ * A line is split once, when it is read, into the bytes spanned by each
+ * range of a list, from the start of its first field to the end of its
+ * last one, so that the fields are never searched for again.
+ */
+
+static int
+field_number(char const **s, uint32_t *n)
+{
+	char const *p = *s;
+
+	*n = 0;
+	if (*p < '0' || *p > '9')
+		return 0;
+	for (; *p >= '0' && *p <= '9'; p++)
+		if ((*n = *n * 10 + *p - '0') > 1000000)
+			return -1;
+	*s = p;
+	return 1;
+}
+
+/*
+ * Parse a list such as "1,3-5,7-" into `fl', or return -1 if it is not
+ * valid.  With `split', each field of a range with an end gets a range of
+ * its own.
+ */
+int
+field_parse(struct field_list *fl, char const *s, int split)
+{
+	uint32_t first, last;
+	int r;
+
+	fl->count = 0;
+	fl->stop = 0;
+	do {
+		if ((r = field_number(&s, &first)) < 0)
+			return -1;
+		if (r == 0)
+			first = 1;
+		last = first;
+		if (*s == '-') {
+			s++;
+			if ((r = field_number(&s, &last)) < 0)
+				return -1;
+			if (r == 0)
+				last = FIELD_LAST;
+		} else if (r == 0) {
+			return -1;
+		}
+		if (first == 0 || last < first)
+			return -1;
+		if ((last == FIELD_LAST ? first : last) > fl->stop)
+			fl->stop = last == FIELD_LAST ? first : last;
+		for (; split && last != FIELD_LAST && first < last; first++) {
+			if (fl->count == FIELD_RANGES_MAX)
+				return -1;
+			fl->ranges[fl->count].first = first;
+			fl->ranges[fl->count].last = first;
+			fl->count++;
+		}
+		if (fl->count == FIELD_RANGES_MAX)
+			return -1;
+		fl->ranges[fl->count].first = first;
+		fl->ranges[fl->count].last = last;
+		fl->count++;
+	} while (*s++ == ',');
+	return s[-1] == '\0' ? 0 : -1;
+}
+
+static int
+field_is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+/*
+ * Write to `spans' the offset of the start and of the end of each range of
+ * `fl' in the `len' bytes of `s', fields split by `delim'.  The ranges past
+ * the last field of the line are left empty at its end.  The fields past
+ * `fl->stop' are not split, the ranges running to the end of the line
+ * ending there.
+ */
+void
+field_spans(struct field_list const *fl, int delim, char const *s, size_t len,
+	uint32_t *spans)
+{
+	size_t beg = 0, end;
+
+	if (fl->count == 0)
+		return;
+	for (int r = 0; r < fl->count; r++)
+		spans[r * 2] = spans[r * 2 + 1] = len;
+	if (delim == FIELD_BLANKS)
+		while (beg < len && field_is_blank(s[beg]))
+			beg++;
+
+	for (uint32_t f = 1;; f++) {
+		if (delim == FIELD_BLANKS) {
+			if (beg == len)
+				break;
+			for (end = beg; end < len && !field_is_blank(s[end]);)
+				end++;
+		} else {
+			for (end = beg; end < len && s[end] != delim;)
+				end++;
+		}
+
+		for (int r = 0; r < fl->count; r++) {
+			if (f == fl->ranges[r].first)
+				spans[r * 2] = beg;
+			if (f >= fl->ranges[r].first && f <= fl->ranges[r].last)
+				spans[r * 2 + 1] = end;
+		}
+
+		if (end == len)
+			break;
+		if (f == fl->stop) {
+			while (delim == FIELD_BLANKS && field_is_blank(s[len - 1]))
+				len--;
+			for (int r = 0; r < fl->count; r++)
+				if (fl->ranges[r].last == FIELD_LAST
+				  && fl->ranges[r].first <= f)
+					spans[r * 2 + 1] = len;
+			break;
+		}
+		beg = end + 1;
+		if (delim == FIELD_BLANKS)
+			while (beg < len && field_is_blank(s[beg]))
+				beg++;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef FIELD_H
+#define FIELD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FIELD_RANGES_MAX 32
+#define FIELD_LAST UINT32_MAX
+#define FIELD_BLANKS (-1)
+
+/*
+ * A list of ranges of fields as given to cut(1), from 1, the last one of a
+ * range being FIELD_LAST if it runs to the end of the line, and the last
+ * field that has to be found to know where they all are.
+ */
+struct field_list {
+	struct { uint32_t first, last; } ranges[FIELD_RANGES_MAX];
+	int count;
+	uint32_t stop;
+};
+
+int	field_parse(struct field_list *fl, char const *s, int split);
+void	field_spans(struct field_list const *fl, int delim, char const *s,
+		  size_t len, uint32_t *spans);
+
+#endif
@@ -0,0 +1,137 @@
+#include "fold.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "utf8.h"
+
+/*
+ * Unicode simple case folding, for the text to be searched without regard
+ * to case.  The folded text has the length of the original, byte for byte,
+ * so that it is searched at the same offsets: the few characters whose
+ * folded form has a UTF-8 encoding of another length are not folded, and
+ * neither are invalid UTF-8 sequences.
+ *
+ * The table is generated by mkfold.pl: the high bits of a codepoint select
+ * a block of 2^FOLD_BITS codepoints in `fold_stage1', and its entry in that
+ * block the difference to add to it.
+ *
+ * The runs of ASCII are folded 8 bytes at a time.
+ */
+
+#include "foldtab.h"
+
+#define FOLD_ONES (~(uint64_t)0 / 255)
+#define FOLD_HIGH (FOLD_ONES * 128)
+
+uint32_t
+fold_rune(uint32_t c)
+{
+	if (c > FOLD_MAX)
+		return c;
+	return c + fold_delta[fold_stage2[fold_stage1[c >> FOLD_BITS]]
+	  [c & ((1 << FOLD_BITS) - 1)]];
+}
+
+/*
+ * Flag the uppercase ASCII letters of the 8 bytes of `x' with their 0x80
+ * bit, the others with none, without a branch per byte.
+ */
+static uint64_t
+fold_upper8(uint64_t x)
+{
+	uint64_t low = x & FOLD_ONES * 127;
+
+	return (FOLD_ONES * (127 + 'Z' + 1) - low) & ~x
+	  & (low + FOLD_ONES * (127 - 'A' + 1)) & FOLD_HIGH;
+}
+
+static int
+fold_is_upper(uint8_t c)
+{
+	return (uint8_t)(c - 'A') < 26;
+}
+
+/*
+ * Decode the character at the start of `s', and return its length, or 1
+ * with UINT32_MAX in `c' for an invalid byte.
+ */
+static size_t
+fold_decode(char const *s, size_t len, uint32_t *c)
+{
+	uint32_t state = UTF8_ACCEPT;
+
+	for (size_t i = 0; i < len && i < 4; i++) {
+		if (utf8_decode(&state, c, (uint8_t)s[i]) == UTF8_ACCEPT)
+			return i + 1;
+		if (state == UTF8_REJECT)
+			break;
+	}
+	*c = UINT32_MAX;
+	return 1;
+}
+
+/*
+ * Length of the start of `s' that folding leaves as it is.
+ */
+size_t
+fold_span(char const *s, size_t len)
+{
+	uint64_t x;
+	uint32_t c;
+	size_t i = 0, n;
+
+	while (i < len) {
+		if (i + 8 <= len) {
+			memcpy(&x, s + i, 8);
+			if ((x & FOLD_HIGH) == 0 && fold_upper8(x) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+		if ((uint8_t)s[i] < 0x80) {
+			if (fold_is_upper(s[i]))
+				return i;
+			i++;
+			continue;
+		}
+		n = fold_decode(s + i, len - i, &c);
+		if (fold_rune(c) != c)
+			return i;
+		i += n;
+	}
+	return len;
+}
+
+/*
+ * Fold the `len' bytes of `src' into as many bytes of `dst'.
+ */
+void
+fold_utf8(char *dst, char const *src, size_t len)
+{
+	uint64_t x;
+	uint32_t c, f;
+	size_t i = 0, n;
+
+	while (i < len) {
+		if (i + 8 <= len) {
+			memcpy(&x, src + i, 8);
+			if ((x & FOLD_HIGH) == 0) {
+				x |= fold_upper8(x) >> 2;
+				memcpy(dst + i, &x, 8);
+				i += 8;
+				continue;
+			}
+		}
+		if ((uint8_t)src[i] < 0x80) {
+			dst[i] = fold_is_upper(src[i]) ? src[i] | 0x20 : src[i];
+			i++;
+			continue;
+		}
+		n = fold_decode(src + i, len - i, &c);
+		if ((f = fold_rune(c)) != c)
+			utf8_encode(dst + i, f);
+		else
+			memcpy(dst + i, src + i, n);
+		i += n;
+	}
+}
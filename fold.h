@@ -0,0 +1,11 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t	fold_rune(uint32_t c);
+size_t		fold_span(char const *s, size_t len);
+void		fold_utf8(char *dst, char const *src, size_t len);
+
+#endif
@@ -0,0 +1,176 @@
+#include "fuzzy.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Fuzzy matching: a token matches a line if its bytes are found in the
+ * line in the same order, not necessarily next to each other, ignoring
+ * case: the lines and tokens are given folded with fold_utf8(), and the
+ * original line too to fuzzy_score(), as it needs the case for its bonuses.
+ *
+ * Among the ways to find them, the score is the one of the best, with each
+ * byte found worth more at the start of a word or path component, and
+ * more if it follows the previous one, less if there is a gap before it.
+ */
+
+#define FUZZY_MATCH		16
+#define FUZZY_CONSECUTIVE	4
+#define FUZZY_GAP_START		3
+#define FUZZY_GAP		1
+#define FUZZY_NONE		(-(1 << 24))
+
+static uint8_t
+fuzzy_fold(uint8_t c)
+{
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static int
+fuzzy_is_alnum(uint8_t c)
+{
+	c = fuzzy_fold(c);
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+/*
+ * Bonus for a byte found at `s[i]', depending on the byte before it.
+ */
+static int
+fuzzy_bonus(char const *s, size_t i)
+{
+	uint8_t prev = i > 0 ? s[i - 1] : '/', c = s[i];
+
+	switch (prev) {
+	case '/':
+		return 10;
+	case ' ': case '\t': case '_': case '-': case '.': case ':':
+		return 8;
+	}
+	if (prev >= 'a' && prev <= 'z' && c >= 'A' && c <= 'Z')
+		return 7;
+	if (!fuzzy_is_alnum(prev) && fuzzy_is_alnum(c))
+		return 8;
+	return 0;
+}
+
+/*
+ * Set of the bytes of the folded `s' in 64 classes, for a token to be only
+ * searched in the lines having all of its classes.
+ */
+uint64_t
+fuzzy_mask(char const *s, size_t len)
+{
+	uint64_t mask = 0;
+
+	for (size_t i = 0; i < len; i++)
+		mask |= (uint64_t)1 << (s[i] & 63);
+	return mask;
+}
+
+/*
+ * Tell if the bytes of the token are all in the line in the same order,
+ * for a line and a token both already folded to lowercase.
+ */
+int
+fuzzy_match(char const *s, size_t len, char const *tok, size_t toklen)
+{
+	char const *end = s + len;
+
+	for (size_t j = 0; j < toklen; j++, s++)
+		if ((s = memchr(s, tok[j], end - s)) == NULL)
+			return 0;
+	return 1;
+}
+
+/*
+ * Score of the first occurrence of each byte of the token in turn, for
+ * the lines too long for fuzzy_score() to try them all.
+ */
+static int
+fuzzy_score_first(char const *s, char const *fold, size_t len,
+	char const *tok, size_t toklen)
+{
+	size_t i, j, last = 0;
+	int score = 0;
+
+	for (i = 0, j = 0; i < len && j < toklen; i++) {
+		if (fold[i] != tok[j])
+			continue;
+		score += FUZZY_MATCH + fuzzy_bonus(s, i) * (j == 0 ? 2 : 1);
+		if (j > 0 && i == last + 1)
+			score += FUZZY_CONSECUTIVE;
+		else if (j > 0)
+			score -= FUZZY_GAP_START + FUZZY_GAP * (i - last - 2);
+		last = i;
+		j++;
+	}
+	return score;
+}
+
+/*
+ * Score of the best way to find the token in the line, computed row by row
+ * for each byte of the token: `prev[i]' is the best score of the bytes of
+ * the token so far with the last one at `s[i]', and `gap' the best one with
+ * the last one before `s[i - 1]', gap penalty included.  Only the part of
+ * the line from the first byte of the token to its last one is searched.
+ */
+int
+fuzzy_score(char const *s, char const *fold, size_t len, char const *tok,
+	size_t toklen)
+{
+	int rows[2][FUZZY_COLS], *prev = rows[0], *cur = rows[1], *swap;
+	int8_t bonus[FUZZY_COLS];
+	int best, gap;
+	size_t beg, end;
+	char c;
+
+	if (toklen == 0)
+		return 0;
+	if (len > FUZZY_COLS)
+		return fuzzy_score_first(s, fold, len, tok, toklen);
+
+	for (beg = 0; beg < len && fold[beg] != tok[0]; beg++)
+		continue;
+	for (end = len; end > beg && fold[end - 1] != tok[toklen - 1]; end--)
+		continue;
+	if (end <= beg)
+		return FUZZY_NONE;
+
+	for (size_t i = beg; i < end; i++) {
+		bonus[i] = fuzzy_bonus(s, i);
+		prev[i] = fold[i] == tok[0]
+		  ? FUZZY_MATCH + 2 * bonus[i] : FUZZY_NONE;
+	}
+	for (size_t j = 1; j < toklen; j++) {
+		c = tok[j];
+		gap = FUZZY_NONE;
+		cur[beg] = FUZZY_NONE;
+		for (size_t i = beg + 1; i < end; i++) {
+			int h;
+
+			if (i >= beg + 2
+			  && prev[i - 2] - FUZZY_GAP_START > gap - FUZZY_GAP)
+				gap = prev[i - 2] - FUZZY_GAP_START;
+			else
+				gap -= FUZZY_GAP;
+			cur[i] = FUZZY_NONE;
+			if (fold[i] != c)
+				continue;
+			h = prev[i - 1] + FUZZY_CONSECUTIVE;
+			if (gap > h)
+				h = gap;
+			if (h > FUZZY_NONE / 2)
+				cur[i] = h + FUZZY_MATCH + bonus[i];
+		}
+		swap = prev;
+		prev = cur;
+		cur = swap;
+	}
+
+	best = FUZZY_NONE;
+	for (size_t i = beg; i < end; i++)
+		if (prev[i] > best)
+			best = prev[i];
+	return best;
+}
@@ -0,0 +1,15 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUZZY_COLS 1024
+
+uint64_t	fuzzy_mask(char const *s, size_t len);
+int		fuzzy_match(char const *s, size_t len, char const *tok,
+		  size_t toklen);
+int		fuzzy_score(char const *s, char const *fold, size_t len,
+		  char const *tok, size_t toklen);
+
+#endif
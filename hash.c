@@ -0,0 +1,56 @@
+#include "hash.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A hash of lines to tell them apart in the tables of the program, not
+ * meant to resist collisions made on purpose: 8 bytes are mixed in at once
+ * with a multiplication, the last 8 overlapping the ones before, or the
+ * shorter lines read in a few overlapping loads, and the result is mixed
+ * further at the end, as splitmix64 does, for its low bits to index a
+ * table.  It depends on the byte order of the machine.
+ */
+
+#define HASH_K 0x9e3779b97f4a7c15ULL
+
+static uint64_t
+hash_load(char const *s, size_t len)
+{
+	uint64_t w = 0;
+	uint32_t a, b;
+
+	if (len >= 4) {
+		memcpy(&a, s, 4);
+		memcpy(&b, s + len - 4, 4);
+		return (uint64_t)a << 32 | b;
+	}
+	if (len > 0)
+		w = (uint64_t)(uint8_t)s[0] << 16 | (uint64_t)(uint8_t)s[len / 2] << 8
+		  | (uint8_t)s[len - 1];
+	return w;
+}
+
+uint64_t
+hash_bytes(char const *s, size_t len)
+{
+	uint64_t h = len * HASH_K, w;
+	char const *end = s + len;
+
+	if (len >= 8) {
+		for (; end - s > 8; s += 8) {
+			memcpy(&w, s, 8);
+			h = (h ^ w) * HASH_K;
+			h ^= h >> 32;
+		}
+		memcpy(&w, end - 8, 8);
+	} else {
+		w = hash_load(s, len);
+	}
+	h = (h ^ w) * HASH_K;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return h ^ h >> 31;
+}
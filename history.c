@@ -0,0 +1,290 @@
+#include "history.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash.h"
+
+/*
+ * The lines selected before, kept in a file as an open-addressing hash
+ * table of their hash and length, looked up in place once mapped.  It is
+ * only valid on the same kind of machine, as the cache of -C.
+ *
+ * A line selected again gets its count decayed to the current time plus
+ * one.  The table is written again whole to a temporary file renamed over
+ * the previous one, so that it is never seen half written, dropping the
+ * lines whose count decayed below HISTORY_COUNT_MIN, with a lock held for
+ * the selections made at once to all be counted.
+ */
+
+#define HISTORY_MAGIC "iomenuH\1"
+#define HISTORY_COUNT_MIN (1.0 / 64)
+
+struct history_header {
+	char magic[8];
+	uint64_t size, count;
+};
+
+static uint64_t
+history_hash(char const *s, size_t len)
+{
+	uint64_t hash = hash_bytes(s, len);
+
+	/* 0 is for the empty slots */
+	return hash != 0 ? hash : 1;
+}
+
+/*
+ * Bit of the `len' bytes of `s' in the filter of the lines of a history,
+ * from its length and from up to 8 bytes in its middle and 8 at its end,
+ * cheaper to get than its hash.
+ */
+static uint32_t
+history_filter(char const *s, size_t len)
+{
+	uint64_t mid = 0, end = 0;
+
+	if (len >= 8) {
+		memcpy(&mid, s + (len - 8) / 2, 8);
+		memcpy(&end, s + len - 8, 8);
+	} else {
+		memcpy(&end, s, len);
+	}
+	end = ((mid * 0x9e3779b97f4a7c15ULL) ^ end ^ len) * 0xbf58476d1ce4e5b9ULL;
+	return end >> (64 - HISTORY_FILTER_BITS);
+}
+
+/*
+ * The slot of the line with `hash' and `len' in the `size' slots of
+ * `slots', or the empty one where it would be.
+ */
+static struct history_slot *
+history_slot(struct history_slot *slots, size_t size, uint64_t hash,
+	uint32_t len)
+{
+	size_t i = hash & (size - 1);
+
+	while (slots[i].hash != 0
+	  && (slots[i].hash != hash || slots[i].len != len))
+		i = (i + 1) & (size - 1);
+	return slots + i;
+}
+
+/*
+ * Map the history of `path', empty if there is none yet or if it is not
+ * valid, to be overwritten by history_add().  Return -1 on error.
+ */
+int
+history_load(struct history *h, char const *path)
+{
+	struct history_header *hdr;
+	struct stat st;
+	int fd;
+
+	memset(h, 0, sizeof *h);
+	h->now = (double)time(NULL) / HISTORY_HALF_LIFE;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if ((uintmax_t)st.st_size > SIZE_MAX
+	  || (size_t)st.st_size < sizeof *hdr) {
+		close(fd);
+		return 0;
+	}
+	h->len = st.st_size;
+	h->map = mmap(NULL, h->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (h->map == MAP_FAILED) {
+		h->map = NULL;
+		return -1;
+	}
+
+	hdr = h->map;
+	if (memcmp(hdr->magic, HISTORY_MAGIC, sizeof hdr->magic) != 0
+	  || hdr->size < HISTORY_SLOTS_MIN || (hdr->size & (hdr->size - 1))
+	  || hdr->size > (h->len - sizeof *hdr) / sizeof *h->slots
+	  || sizeof *hdr + hdr->size * sizeof *h->slots != h->len)
+		goto invalid;
+	h->slots = (struct history_slot *)(hdr + 1);
+	h->size = hdr->size;
+	for (size_t i = 0; i < h->size; i++) {
+		uint32_t bit = h->slots[i].filter;
+
+		if (h->slots[i].hash == 0)
+			continue;
+		if (bit >> HISTORY_FILTER_BITS != 0)
+			goto invalid;
+		h->filter[bit / 8] |= 1 << bit % 8;
+		h->count++;
+	}
+	/* with an empty slot left for the lookups to stop */
+	if (h->count != hdr->count || h->count >= h->size)
+		goto invalid;
+	return 0;
+invalid:
+	munmap(h->map, h->len);
+	memset(h, 0, sizeof *h);
+	h->now = (double)time(NULL) / HISTORY_HALF_LIFE;
+	return 0;
+}
+
+/*
+ * The decayed count of the times the `len' bytes of `s' were selected, or
+ * 0 if they never were.
+ */
+double
+history_count(struct history const *h, char const *s, size_t len)
+{
+	struct history_slot *slot;
+	uint32_t bit;
+
+	if (h->count == 0)
+		return 0;
+	bit = history_filter(s, len);
+	if (!(h->filter[bit / 8] >> bit % 8 & 1))
+		return 0;
+	slot = history_slot(h->slots, h->size, history_hash(s, len), len);
+	if (slot->hash == 0)
+		return 0;
+	return exp2(slot->rank - h->now);
+}
+
+static int
+history_write(int fd, void const *buf, size_t len)
+{
+	char const *s = buf;
+	ssize_t r;
+
+	for (; len > 0; s += r, len -= r) {
+		if ((r = write(fd, s, len)) == -1) {
+			if (errno != EINTR)
+				return -1;
+			r = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Count one more selection of the `len' bytes of `s' in the history of
+ * `path', with the lock of history_add() held.
+ */
+static int
+history_update(char const *path, char const *s, size_t len)
+{
+	struct history h;
+	struct history_header hdr;
+	struct history_slot *slots, *slot;
+	char tmp[PATH_MAX];
+	uint64_t hash = history_hash(s, len);
+	size_t count = 1, size = HISTORY_SLOTS_MIN;
+	double c;
+	int fd, r;
+
+	if (len > UINT32_MAX)
+		return -1;
+	if (history_load(&h, path) < 0)
+		return -1;
+	for (size_t i = 0; i < h.size; i++)
+		if (h.slots[i].hash != 0
+		  && exp2(h.slots[i].rank - h.now) >= HISTORY_COUNT_MIN)
+			count++;
+	while (count * 2 > size)
+		size *= 2;
+	if ((slots = calloc(size, sizeof *slots)) == NULL) {
+		r = -1;
+		goto end;
+	}
+
+	count = 0;
+	for (size_t i = 0; i < h.size; i++) {
+		if (h.slots[i].hash == 0
+		  || exp2(h.slots[i].rank - h.now) < HISTORY_COUNT_MIN)
+			continue;
+		*history_slot(slots, size, h.slots[i].hash, h.slots[i].len)
+		  = h.slots[i];
+		count++;
+	}
+	slot = history_slot(slots, size, hash, len);
+	c = 1;
+	if (slot->hash != 0)
+		c += exp2(slot->rank - h.now);
+	else
+		count++;
+	slot->hash = hash;
+	slot->len = len;
+	slot->filter = history_filter(s, len);
+	slot->rank = log2(c) + h.now;
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, HISTORY_MAGIC, sizeof hdr.magic);
+	hdr.size = size;
+	hdr.count = count;
+	r = snprintf(tmp, sizeof tmp, "%s.%ld", path, (long)getpid());
+	if (r < 0 || (size_t)r >= sizeof tmp) {
+		errno = ENAMETOOLONG;
+		r = -1;
+	} else if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600))
+	  == -1) {
+		r = -1;
+	} else if (history_write(fd, &hdr, sizeof hdr) < 0
+	  || history_write(fd, slots, size * sizeof *slots) < 0) {
+		close(fd);
+		unlink(tmp);
+		r = -1;
+	} else if (close(fd) == -1 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		r = -1;
+	} else {
+		r = 0;
+	}
+	free(slots);
+end:
+	if (h.map != NULL)
+		munmap(h.map, h.len);
+	return r;
+}
+
+/*
+ * Count one more selection of the `len' bytes of `s' in the history of
+ * `path'.  The file is read and replaced with an exclusive lock held on
+ * `path'.lock, so that two menus selecting at once do not both start from
+ * the same table, the last one dropping the selection of the other.
+ * Return -1 on error.
+ */
+int
+history_add(char const *path, char const *s, size_t len)
+{
+	struct flock fl;
+	char lock[PATH_MAX];
+	int fd, r;
+
+	r = snprintf(lock, sizeof lock, "%s.lock", path);
+	if (r < 0 || (size_t)r >= sizeof lock) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((fd = open(lock, O_RDWR | O_CREAT, 0600)) == -1)
+		return -1;
+	memset(&fl, 0, sizeof fl);
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	while ((r = fcntl(fd, F_SETLKW, &fl)) == -1 && errno == EINTR)
+		continue;
+	if (r == 0)
+		r = history_update(path, s, len);
+	/* closing it releases the lock */
+	close(fd);
+	return r;
+}
@@ -0,0 +1,42 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_HALF_LIFE (7 * 24 * 60 * 60)
+#define HISTORY_SLOTS_MIN 256
+#define HISTORY_FILTER_BITS 16
+
+/*
+ * A line selected before, with the log2 of the count of times it was,
+ * each one decayed by half every HISTORY_HALF_LIFE seconds, as it was at
+ * time 0, so that it does not change with the time, and its bit in the
+ * filter of the table.
+ */
+struct history_slot {
+	uint64_t hash;
+	double rank;
+	uint32_t len, filter;
+};
+
+/*
+ * The table of a history file, mapped, with a bitmap of the lengths and of
+ * two of the bytes of its lines, for most of the other lines to be told
+ * apart without hashing them.
+ */
+struct history {
+	void *map;
+	size_t len;
+
+	struct history_slot *slots;
+	size_t size, count;
+	double now;
+	uint8_t filter[(1 << HISTORY_FILTER_BITS) / 8];
+};
+
+int	history_load(struct history *h, char const *path);
+double	history_count(struct history const *h, char const *s, size_t len);
+int	history_add(char const *path, char const *s, size_t len);
+
+#endif
@@ -0,0 +1,193 @@
+#include "index.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Index of the lines by the trigrams they contain, built from the text
+ * case-folded with fold_utf8(), and searched with tokens folded the same
+ * way.  The trigrams are hashed to INDEX_BUCKETS buckets,
+ * each with the list of the lines that have one of its trigrams, stored
+ * one after the other in `posts' from `offs[bucket]' to `offs[bucket + 1]',
+ * as the differences between consecutive line numbers, plus one, encoded
+ * 7 bits per byte.
+ *
+ * A line with the trigrams of a token only may contain the token, so this
+ * only tells which lines can not match, and the others have to be checked.
+ */
+
+static size_t
+index_bucket(char const *s)
+{
+	uint32_t key;
+
+	key = (uint32_t)(uint8_t)s[0] << 16
+	  | (uint32_t)(uint8_t)s[1] << 8
+	  | (uint8_t)s[2];
+	return (key * UINT32_C(2654435761)) >> (32 - INDEX_BITS);
+}
+
+static size_t
+index_varint_len(uint32_t v)
+{
+	size_t len = 1;
+
+	for (; v >= 0x80; v >>= 7)
+		len++;
+	return len;
+}
+
+static uint8_t *
+index_varint_put(uint8_t *p, uint32_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		*p++ = v | 0x80;
+	*p++ = v;
+	return p;
+}
+
+static uint8_t const *
+index_varint_get(uint8_t const *p, uint32_t *v)
+{
+	uint32_t x = 0;
+
+	for (int shift = 0;; shift += 7) {
+		x |= (uint32_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0)
+			break;
+	}
+	*v = x;
+	return p;
+}
+
+/*
+ * Go through the buckets of every line, once each per line: a first time
+ * to size them, and a second time to fill them.  `last' keeps the last
+ * line added to each bucket, plus one, to encode the differences.
+ */
+static void
+index_pass(struct index *ix, char const *buf, size_t const *offs,
+	uint32_t const *lens, size_t count, uint32_t *last, size_t *pos)
+{
+	for (size_t n = 0; n < count; n++) {
+		char const *s = buf + offs[n];
+		size_t len = lens[n];
+
+		for (size_t i = 0; i + 3 <= len; i++) {
+			size_t b = index_bucket(s + i);
+			uint32_t delta;
+
+			if (last[b] == n + 1)
+				continue;
+			delta = n + 1 - last[b];
+			last[b] = n + 1;
+			if (ix->posts == NULL)
+				pos[b] += index_varint_len(delta);
+			else
+				pos[b] = index_varint_put(ix->posts + pos[b], delta)
+				  - ix->posts;
+		}
+	}
+}
+
+/*
+ * Index the `count' lines of `buf', the case-folded text.
+ */
+int
+index_build(struct index *ix, char const *buf, size_t const *offs,
+	uint32_t const *lens, size_t count)
+{
+	uint32_t *last;
+	size_t *pos, total = 0;
+
+	ix->posts = NULL;
+	ix->lines_count = count;
+	ix->offs = malloc((INDEX_BUCKETS + 1) * sizeof *ix->offs);
+	last = calloc(INDEX_BUCKETS, sizeof *last);
+	pos = calloc(INDEX_BUCKETS, sizeof *pos);
+	if (ix->offs == NULL || last == NULL || pos == NULL)
+		goto err;
+
+	index_pass(ix, buf, offs, lens, count, last, pos);
+	for (size_t b = 0; b < INDEX_BUCKETS; b++) {
+		ix->offs[b] = total;
+		total += pos[b];
+		pos[b] = ix->offs[b];
+	}
+	ix->offs[INDEX_BUCKETS] = total;
+
+	if ((ix->posts = malloc(total + 1)) == NULL)
+		goto err;
+	memset(last, 0, INDEX_BUCKETS * sizeof *last);
+	index_pass(ix, buf, offs, lens, count, last, pos);
+
+	free(last);
+	free(pos);
+	return 0;
+err:
+	free(ix->offs);
+	free(last);
+	free(pos);
+	ix->offs = NULL;
+	return -1;
+}
+
+/*
+ * Memory used by the index, in bytes.
+ */
+size_t
+index_size(struct index const *ix)
+{
+	return (INDEX_BUCKETS + 1) * sizeof *ix->offs + ix->offs[INDEX_BUCKETS];
+}
+
+/*
+ * Keep only the lines of `m' that have a chance to contain the token, or
+ * for which `keep' returns true, and return how many are left.  The buckets
+ * of the token are read from the smallest one, for as long as reading one
+ * costs less than checking the lines left against the token.
+ */
+size_t
+index_filter(struct index const *ix, char const *tok, size_t toklen,
+	uint32_t *m, size_t count, int (*keep)(uint32_t))
+{
+	size_t b[3 * 16], nb = 0;
+
+	for (size_t i = 0; i + 3 <= toklen && nb < sizeof b / sizeof *b; i++) {
+		size_t x = index_bucket(tok + i), j;
+
+		for (j = 0; j < nb && b[j] != x; j++)
+			continue;
+		if (j == nb)
+			b[nb++] = x;
+	}
+
+	while (nb > 0 && count > 0) {
+		uint8_t const *p, *end;
+		size_t min = 0, kept = 0;
+		uint32_t n = 0, delta;
+
+		for (size_t j = 1; j < nb; j++)
+			if (ix->offs[b[j] + 1] - ix->offs[b[j]]
+			  < ix->offs[b[min] + 1] - ix->offs[b[min]])
+				min = j;
+		p = ix->posts + ix->offs[b[min]];
+		end = ix->posts + ix->offs[b[min] + 1];
+		if ((size_t)(end - p) > count * 16)
+			break;
+		b[min] = b[--nb];
+
+		/* `n' is the last line of the bucket read so far, plus one */
+		for (size_t i = 0; i < count; i++) {
+			while (n <= m[i] && p < end) {
+				p = index_varint_get(p, &delta);
+				n += delta;
+			}
+			if (n == m[i] + 1 || keep(m[i]))
+				m[kept++] = m[i];
+		}
+		count = kept;
+	}
+	return count;
+}
@@ -0,0 +1,23 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "input.h"
+
+#define INDEX_BITS 20
+#define INDEX_BUCKETS ((size_t)1 << INDEX_BITS)
+
+struct index {
+	size_t *offs;
+	uint8_t *posts;
+	size_t lines_count;
+};
+
+int	index_build(struct index *ix, char const *buf, size_t const *offs,
+		  uint32_t const *lens, size_t count);
+size_t	index_size(struct index const *ix);
+size_t	index_filter(struct index const *ix, char const *tok, size_t toklen,
+		  uint32_t *m, size_t count, int (*keep)(uint32_t));
+
+#endif
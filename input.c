@@ -0,0 +1,341 @@
+#include "input.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fold.h"
+#include "hash.h"
+
+/*
+ * Grow an array geometrically so that it has room for at least `need'
+ * elements of size `sz'.
+ */
+static int
+input_grow(void *ptr_p, size_t *size, size_t need, size_t sz)
+{
+	void **ptr = ptr_p, *new;
+	size_t n;
+
+	if (need <= *size)
+		return 0;
+	for (n = *size ? *size : 1024; n < need; n *= 2)
+		continue;
+	if ((new = realloc(*ptr, n * sz)) == NULL)
+		return -1;
+	*ptr = new;
+	*size = n;
+	return 0;
+}
+
+/*
+ * Offset of a line dropped with -U for one read after it, until
+ * input_end() removes it.
+ */
+#define INPUT_DROPPED SIZE_MAX
+
+/*
+ * Lines split before being looked up at once with -u or -U, all hashed
+ * first, for the lookups of several of them to wait on memory at the same
+ * time.
+ */
+#define INPUT_BATCH 256
+
+static int
+input_add_line(struct input *in, size_t end)
+{
+	size_t size = in->lines_size;
+
+	if (in->lines_count == INPUT_LINES_MAX
+	  || end - in->line_start > INPUT_LINE_LEN_MAX) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	if (input_grow(&in->offs, &size, in->lines_count + 1,
+	  sizeof *in->offs) < 0
+	  || input_grow(&in->lens, &in->lines_size, in->lines_count + 1,
+	  sizeof *in->lens) < 0)
+		return -1;
+	in->offs[in->lines_count] = in->line_start;
+	in->lens[in->lines_count] = end - in->line_start;
+	in->lines_count++;
+	in->line_start = end + 1;
+	return 0;
+}
+
+/*
+ * Make room in the set of the lines kept with -u or -U for all of them,
+ * filled up to three quarters, counting those dropped with -U.  A mapped
+ * file is expected to have as many more lines as the ones split first
+ * tell, for the set to be the right size from the start.  The lines are
+ * moved with the bits of their hash kept along, without hashing them again.
+ */
+static int
+input_reserve(struct input *in)
+{
+	struct input_slot *set;
+	size_t size = in->set_size ? in->set_size : 1024, need, i;
+
+	need = in->lines_count;
+	if (in->set_size == 0 && in->mapped && in->line_start > 0)
+		need = (double)need * in->len / in->line_start;
+	while (need > size / 4 * 3)
+		size *= 2;
+	if (size == in->set_size)
+		return 0;
+	if ((set = calloc(size, sizeof *set)) == NULL)
+		return -1;
+	for (size_t j = 0; j < in->set_size; j++) {
+		if (in->set[j].line == 0)
+			continue;
+		for (i = in->set[j].hash & (size - 1); set[i].line != 0;
+		  i = (i + 1) & (size - 1))
+			continue;
+		set[i] = in->set[j];
+	}
+	free(in->set);
+	in->set = set;
+	in->set_size = size;
+	return 0;
+}
+
+/*
+ * Look the lines added from `first' up among those kept before with -u
+ * or -U, comparing their bytes with those of the ones of the same hash, and
+ * remove those dropped, the new ones with -u, and the previous ones once
+ * all are read with -U.
+ */
+static int
+input_unique(struct input *in, size_t first)
+{
+	struct input_slot *set;
+	size_t *offs = in->offs, mask, w = first, i;
+	uint32_t *lens = in->lens, hashes[INPUT_BATCH], n;
+
+	if (input_reserve(in) < 0)
+		return -1;
+	set = in->set;
+	mask = in->set_size - 1;
+	for (size_t k = first; k < in->lines_count; k++)
+		hashes[k - first] = hash_bytes(in->buf + offs[k], lens[k]);
+
+	for (size_t k = first; k < in->lines_count; k++) {
+		uint32_t hash = hashes[k - first];
+
+		for (i = hash & mask; (n = set[i].line) != 0; i = (i + 1) & mask)
+			if (set[i].hash == hash && lens[n - 1] == lens[k]
+			  && memcmp(in->buf + offs[n - 1], in->buf + offs[k],
+			  lens[k]) == 0)
+				break;
+		if (n != 0) {
+			in->dup_count++;
+			if (in->unique == INPUT_UNIQUE_FIRST)
+				continue;
+			offs[n - 1] = INPUT_DROPPED;
+		}
+		set[i].hash = hash;
+		set[i].line = w + 1;
+		offs[w] = offs[k];
+		lens[w++] = lens[k];
+	}
+	in->lines_count = w;
+	return 0;
+}
+
+/*
+ * Fold the buffer up to `end' into `fold', only allocated once there is
+ * something to fold.
+ */
+static int
+input_fold(struct input *in, size_t end)
+{
+	size_t beg = in->fold_len;
+
+	if (in->fold == NULL) {
+		beg += fold_span(in->buf + beg, end - beg);
+		if (beg < end) {
+			if ((in->fold = malloc(in->size)) == NULL)
+				return -1;
+			memcpy(in->fold, in->buf, beg);
+		}
+	}
+	if (in->fold != NULL)
+		fold_utf8(in->fold + beg, in->buf + beg, end - beg);
+	in->fold_len = end;
+	return 0;
+}
+
+/*
+ * Record every line ending within the `beg' to `end' range of the buffer,
+ * leaving the buffer itself untouched, and drop those read before with -u
+ * or -U by batches.
+ */
+static int
+input_split(struct input *in, size_t beg, size_t end)
+{
+	char *s = in->buf + beg, *e = in->buf + end, *nl;
+	size_t first = in->lines_count;
+
+	for (; (nl = memchr(s, '\n', e - s)) != NULL; s = nl + 1) {
+		if (input_add_line(in, nl - in->buf) < 0)
+			return -1;
+		if (in->unique && in->lines_count - first == INPUT_BATCH) {
+			if (input_unique(in, first) < 0)
+				return -1;
+			first = in->lines_count;
+		}
+	}
+	if (in->unique && input_unique(in, first) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Map all of `fd' in memory if it is a regular file read from its start.
+ */
+static char *
+input_map_file(int fd, size_t *len)
+{
+	struct stat st;
+	char *map;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+		return NULL;
+	if (st.st_size == 0 || (uintmax_t)st.st_size > SIZE_MAX
+	  || lseek(fd, 0, SEEK_CUR) != 0)
+		return NULL;
+	*len = st.st_size;
+
+	map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	return map == MAP_FAILED ? NULL : map;
+}
+
+/*
+ * Map `fd' in memory if it is a regular file, and index its lines in place,
+ * without copying it.  Return 0 if it has to be read with input_read()
+ * instead.
+ */
+int
+input_map(struct input *in, int fd)
+{
+	char *map;
+	size_t len;
+
+	if ((map = input_map_file(fd, &len)) == NULL)
+		return 0;
+	if (memchr(map, '\0', len) != NULL) {
+		munmap(map, len);
+		return 0;
+	}
+
+	in->buf = map;
+	in->len = in->size = len;
+	in->mapped = 1;
+	if (input_split(in, 0, len) < 0 || input_fold(in, len) < 0)
+		return -1;
+	return 1;
+}
+
+/*
+ * Same as input_map(), with the `count' lines of the file already known,
+ * from a previous input_map() of it, and its copy folded to lowercase, or
+ * NULL if folding leaves it as it is: they are used as they are, without
+ * splitting or folding the file.
+ */
+int
+input_map_lines(struct input *in, int fd, size_t *offs, uint32_t *lens,
+	size_t count, char *fold)
+{
+	char *map;
+	size_t len;
+
+	if ((map = input_map_file(fd, &len)) == NULL)
+		return 0;
+
+	in->buf = map;
+	in->len = in->size = len;
+	in->mapped = 1;
+	in->offs = offs;
+	in->lens = lens;
+	in->lines_count = in->lines_size = count;
+	in->line_start = len;
+	in->fold = fold;
+	in->fold_len = len;
+	return 1;
+}
+
+/*
+ * Read one large block from `fd' at the end of the buffer, drop the '\0'
+ * bytes from it and index the lines it completes.  Return 1 if data was
+ * read, 0 at end of file.
+ */
+int
+input_read(struct input *in, int fd)
+{
+	char *beg, *end, *nul, *fold;
+	size_t size = in->size;
+	ssize_t r;
+
+	if (input_grow(&in->buf, &in->size, in->len + INPUT_BLOCK, 1) < 0)
+		return -1;
+	if (in->fold != NULL && in->size != size) {
+		if ((fold = realloc(in->fold, in->size)) == NULL)
+			return -1;
+		in->fold = fold;
+	}
+	do {
+		r = read(fd, in->buf + in->len, in->size - in->len);
+	} while (r == -1 && errno == EINTR);
+	if (r <= 0)
+		return r;
+
+	beg = in->buf + in->len;
+	end = beg + r;
+	if ((nul = memchr(beg, '\0', r)) != NULL) {
+		char *d = nul;
+
+		for (; nul < end; nul++) {
+			if (*nul == '\0')
+				in->nul_count++;
+			else
+				*d++ = *nul;
+		}
+		end = d;
+	}
+	in->len = end - in->buf;
+
+	if (input_split(in, beg - in->buf, in->len) < 0
+	  || input_fold(in, in->line_start) < 0)
+		return -1;
+	return 1;
+}
+
+/*
+ * Index the last line if it was not terminated by a newline, and remove
+ * the ones dropped with -U, read again after.
+ */
+int
+input_end(struct input *in)
+{
+	size_t n = 0;
+
+	if (in->line_start < in->len && (input_add_line(in, in->len) < 0
+	  || (in->unique && input_unique(in, in->lines_count - 1) < 0)))
+		return -1;
+	if (in->unique == INPUT_UNIQUE_LAST && in->set != NULL) {
+		for (size_t i = 0; i < in->lines_count; i++) {
+			if (in->offs[i] == INPUT_DROPPED)
+				continue;
+			in->offs[n] = in->offs[i];
+			in->lens[n++] = in->lens[i];
+		}
+		in->lines_count = n;
+	}
+	free(in->set);
+	in->set = NULL;
+	in->set_size = 0;
+	return input_fold(in, in->len);
+}
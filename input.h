@@ -0,0 +1,55 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INPUT_BLOCK (64 * 1024)
+#define INPUT_LINES_MAX UINT32_MAX
+#define INPUT_LINE_LEN_MAX UINT32_MAX
+
+/*
+ * Occurrence of the lines read more than once kept with -u and -U.
+ */
+#define INPUT_UNIQUE_FIRST 1
+#define INPUT_UNIQUE_LAST 2
+
+/*
+ * A line kept with -u or -U, numbered from 1 for 0 to mark the empty
+ * slots, with 32 bits of its hash, in the set of those read so far.
+ */
+struct input_slot {
+	uint32_t hash, line;
+};
+
+/*
+ * The lines are kept as the offset of their start in `buf' and their
+ * length, in two arrays, and `fold' is a copy of the first `fold_len' bytes
+ * of `buf' case-folded, or NULL while folding leaves them as they are.
+ * With `unique' set, the lines already read are dropped as they are split,
+ * using `set', freed once they are all read.
+ */
+struct input {
+	char *buf, *fold;
+	size_t len, size, fold_len;
+	int mapped;
+
+	size_t *offs;
+	uint32_t *lens;
+	size_t lines_count, lines_size;
+	size_t line_start;
+
+	int unique;
+	struct input_slot *set;
+	size_t set_size;
+
+	size_t nul_count, dup_count;
+};
+
+int	input_map(struct input *in, int fd);
+int	input_map_lines(struct input *in, int fd, size_t *offs,
+		  uint32_t *lens, size_t count, char *fold);
+int	input_read(struct input *in, int fd);
+int	input_end(struct input *in);
+
+#endif
@@ -2,47 +2,409 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <math.h>
+#include <poll.h>
 #include <signal.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include "cache.h"
 #include "compat.h"
+#include "field.h"
+#include "fold.h"
+#include "fuzzy.h"
+#include "history.h"
+#include "index.h"
+#include "input.h"
+#include "match.h"
+#include "pattern.h"
+#include "pool.h"
+#include "serve.h"
 #include "term.h"
 #include "utf8.h"
 
+struct token {
+	char const *s;
+	size_t len;
+	uint64_t mask;
+};
+
+/*
+ * A match with its score, with -f or -H.
+ */
+struct rank {
+	int32_t score;
+	uint32_t line;
+};
+
+/*
+ * Matches of a prefix of the input, kept aside while the input is longer,
+ * either as an array of line numbers or as a bitmap of all the lines read.
+ */
+struct snapshot {
+	size_t input_len;
+	size_t lines_count;
+	size_t count;
+	uint32_t *buf;
+	uint64_t *bits;
+};
+
+/*
+ * Length of a line as drawn, cut to the width of the screen, kept for the
+ * lines drawn recently so that scrolling back to them does not measure them
+ * again.  With -w, the columns of the line are kept as well, as long as
+ * the widths of the columns stay the same.
+ */
+#define CUT_CACHE 1024
+
+struct cut {
+	uint32_t line;
+	int cols, len;
+
+	unsigned columns_gen;
+	char *row;
+	size_t row_size;
+};
+
+/*
+ * Measures of one input searched, with -S: the time spent on it, and until
+ * it was all searched, or -1 if the input changed before.
+ */
+struct stats_filter {
+	size_t input_len;
+	long work_ns, done_ns;
+	size_t scanned, matched;
+	struct timespec start;
+};
+
+struct stats_frame {
+	long ns;
+	int bytes;
+};
+
+/*
+ * Measures of -S, dumped as JSON on exit.
+ */
+struct stats {
+	struct timespec start;
+	long load_ns, split_ns, index_ns;
+
+	struct stats_filter *filters;
+	size_t filters_count, filters_size;
+
+	struct stats_frame *frames;
+	size_t frames_count, frames_size;
+};
+
 struct {
 	char input[LINE_MAX];
 	size_t cur;
 
-	char **lines_buf;
+	char tokbuf[LINE_MAX];
+	struct token tokv[LINE_MAX / 2 + 1];
+
+	char filter_input[LINE_MAX];
+	size_t filter_len;
+	size_t scan_beg, scan_end, scan_len;
+	size_t lines_filtered;
+	int scan_all, to_end;
+	struct snapshot *stack;
+	size_t stack_count, stack_size;
+
+	struct input in;
+	int eof;
+	struct index index;
+	int indexed;
+
+	uint32_t *headers;
+	size_t headers_count, headers_size, headers_lines;
+
+	uint32_t *fields;
+	size_t fields_lines;
+	int columns[FIELD_RANGES_MAX];
+	unsigned columns_gen;
+
+	struct timespec frame_time;
+
+	char *buf, *fold;
+	size_t *lines_off;
+	uint32_t *lines_len;
 	size_t lines_count;
 
-	char **match_buf;
-	size_t match_count;
+	uint32_t *match_buf;
+	size_t match_count, match_size;
+
+	uint64_t *mask_buf;
+	int32_t *score_buf;
+	struct history history;
+	int32_t *history_buf;
+	size_t history_lines;
+	size_t ranked;
+	struct rank *top;
+	size_t top_count;
+	struct rank *view;
+	size_t view_count, view_size;
+	int view_all, view_changed;
+
+	struct cut cuts[CUT_CACHE];
+
+	struct pattern pattern;
+	struct pattern_dfa dfa[POOL_MAX];
+
+	int conn;
+	pid_t server;
+
+	struct stats stats;
 } ctx;
 
+/*
+ * Lines filtered by one thread at least, for the others to be worth it.
+ */
+#define FILTER_CHUNK (32 * 1024)
+
+/*
+ * Lines filtered between two checks for a key, per thread.
+ */
+#define FILTER_STEP (64 * 1024)
+
+/*
+ * Lines filtered between two checks in lazy mode, to stop close to where
+ * the page is full.
+ */
+#define FILTER_LAZY_STEP 1024
+
+/*
+ * Best matches kept in order of score with -f or -H, until scrolling past
+ * them.
+ */
+#define RANK_TOP 1024
+
+/*
+ * Matches scored by one thread at least, and between two checks for a key,
+ * per thread.
+ */
+#define RANK_CHUNK (4 * 1024)
+#define RANK_STEP (8 * 1024)
+
+/*
+ * Score of a line selected once before with -H, worth four bytes matched
+ * with -f, and as much again each time the count of its selections doubles.
+ */
+#define RANK_HISTORY 64
+
+/*
+ * Work shared by the threads filtering one set of lines: each part of `src',
+ * or of the lines from `beg' if it is NULL, gets its matches written at the
+ * start of the same part of `dst'.
+ */
+struct filter_work {
+	uint32_t const *src;
+	uint32_t *dst;
+	size_t beg, count;
+	struct token *tokv;
+	int jobs;
+	size_t found[POOL_MAX];
+};
+
+/*
+ * Work shared by the threads scoring the `count' matches from `beg'.
+ */
+struct rank_work {
+	size_t beg, count;
+	int jobs;
+};
+
+char const *opt_cache;
+char const *opt_client;
+char const *opt_history;
+char const *opt_keys;
+char const *opt_serve;
+char const *opt_stats;
+char const *opt_times;
 int opt_comment;
+int opt_delim = FIELD_BLANKS;
+int opt_fuzzy;
+int opt_regex;
+int opt_jobs = 1;
+int opt_index;
+int opt_lazy;
+int opt_rank;
+int opt_rate;
+int opt_unique;
+
+/* written to by SIGWINCH, for poll() in event_loop() to wake up on it */
+int winch_pipe[2] = { -1, -1 };
+struct field_list opt_match;
+struct field_list opt_show;
+
+static char *
+line_str(uint32_t n)
+{
+	return ctx.buf + ctx.lines_off[n];
+}
+
+/*
+ * The line folded to lowercase, for searching it.
+ */
+static char *
+line_fold(uint32_t n)
+{
+	return ctx.fold + ctx.lines_off[n];
+}
+
+/*
+ * Offsets of the start and end of the ranges of fields of the line: those
+ * of -n, then those of -w.
+ */
+static uint32_t *
+line_fields(uint32_t n)
+{
+	return ctx.fields + (size_t)n * (opt_match.count + opt_show.count) * 2;
+}
+
+static int
+line_is_header(uint32_t n)
+{
+	return opt_comment && ctx.lines_len[n] > 0 && *line_str(n) == '#';
+}
+
+/*
+ * Position of the first of the `count' lines of `v', in order, that is not
+ * before line `n'.
+ */
+static size_t
+line_bound(uint32_t const *v, size_t count, uint32_t n)
+{
+	size_t lo = 0, hi = count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (v[mid] < n)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Position of line `n' in the matches, or the count of matches if it is
+ * not there yet.
+ */
+static size_t
+match_pos(uint32_t n)
+{
+	size_t i = line_bound(ctx.match_buf, ctx.match_count, n);
+
+	return i < ctx.match_count && ctx.match_buf[i] == n ? i : ctx.match_count;
+}
+
+/*
+ * Position of the last of the headers following each other in the matches
+ * from the one at `i', going by `sign'.  All of the headers are matches, so
+ * the ones after the header at `i' follow it until another line that
+ * matches is between: the last one is searched as the last of them still
+ * at the same distance from it in the matches as in ctx.headers.
+ */
+static size_t
+header_skip(size_t i, int sign)
+{
+	size_t k = line_bound(ctx.headers, ctx.headers_count, ctx.match_buf[i]);
+	size_t lo = 0, hi, mid;
+
+	if (sign > 0)
+		hi = ctx.headers_count - k < ctx.match_count - i
+		  ? ctx.headers_count - k - 1 : ctx.match_count - i - 1;
+	else
+		hi = k < i ? k : i;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (sign > 0 ? ctx.match_buf[i + mid] == ctx.headers[k + mid]
+		  : ctx.match_buf[i - mid] == ctx.headers[k - mid])
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return sign > 0 ? i + lo : i - lo;
+}
+
+static int
+match_token(char const *s, size_t len, struct token const *t)
+{
+	if (opt_fuzzy)
+		return fuzzy_match(s, len, t->s, t->len);
+	return match_memmem(s, len, t->s, t->len) != NULL;
+}
 
 /*
  * Keep the line if it match every token (in no particular order,
- * and allowed to be overlapping).
+ * and allowed to be overlapping).  With -f, the tokens are searched as
+ * fuzzy_match() does, in the lines that have all the bytes of the token.
+ * With -e, the whole input is a pattern, run with the DFA of the thread.
+ * With -n, each token, or the pattern, is searched in each of the ranges of
+ * fields in turn.
  */
 static int
-match_line(char *line, char **tokv)
+match_line(uint32_t n, struct token *tokv, int job)
 {
-	if (opt_comment && line[0] == '#')
+	char const *s = line_fold(n);
+	uint32_t line[2] = { 0, ctx.lines_len[n] }, *v = line;
+	int count = 1, r;
+
+	if (line_is_header(n))
 		return 2;
-	for (; *tokv != NULL; tokv++)
-		if (strcasestr(line, *tokv) == NULL)
+	if (opt_match.count > 0) {
+		v = line_fields(n);
+		count = opt_match.count;
+	}
+	if (opt_regex) {
+		for (r = 0; r < count; r++)
+			if (pattern_match(&ctx.pattern, ctx.dfa + job,
+			  s + v[r * 2], v[r * 2 + 1] - v[r * 2]))
+				return 1;
+		return 0;
+	}
+	/* computed the first time the line is searched */
+	if (opt_fuzzy && ctx.mask_buf[n] == 0)
+		ctx.mask_buf[n] = fuzzy_mask(s, ctx.lines_len[n]) | 1;
+	for (; tokv->s != NULL; tokv++) {
+		if (opt_fuzzy && (tokv->mask & ~ctx.mask_buf[n]) != 0)
 			return 0;
+		for (r = 0; r < count; r++)
+			if (match_token(s + v[r * 2], v[r * 2 + 1] - v[r * 2],
+			  tokv))
+				break;
+		if (r == count)
+			return 0;
+	}
 	return 1;
 }
 
+/*
+ * Line shown at position `i' of the menu: the matches in the order of the
+ * input, or in the order of their score with -f or -H.
+ */
+static uint32_t
+shown_line(size_t i)
+{
+	return opt_rank ? ctx.view[i].line : ctx.match_buf[i];
+}
+
+static size_t
+shown_count(void)
+{
+	return opt_rank ? ctx.view_count : ctx.match_count;
+}
+
 /*
  * Free the structures, reset the terminal state and exit with an
  * error message.
@@ -52,7 +414,9 @@ die(const char *msg)
 {
 	int e = errno;
 
-	term_raw_off(2);
+	/* the terminal is left as it is when replaying keys */
+	if (opt_keys == NULL)
+		term_raw_off(2);
 
 	fprintf(stderr, "iomenu: ");
 	errno = e;
@@ -70,52 +434,758 @@ xrealloc(void *ptr, size_t sz)
 	return ptr;
 }
 
-void *
-xmalloc(size_t sz)
+void *
+xmalloc(size_t sz)
+{
+	void *ptr;
+
+	ptr = malloc(sz);
+	if (ptr == NULL)
+		die("malloc");
+	return ptr;
+}
+
+static long
+elapsed_ns(struct timespec const *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000000L
+	  + (now.tv_nsec - since->tv_nsec);
+}
+
+/*
+ * Start measuring the search of a new input with -S, and give up on the
+ * previous one if it was not done.
+ */
+static void
+stats_filter_begin(size_t input_len)
+{
+	struct stats *st = &ctx.stats;
+	struct stats_filter *f;
+
+	if (st->filters_count == st->filters_size) {
+		st->filters_size = st->filters_size ? st->filters_size * 2 : 64;
+		st->filters = xrealloc(st->filters,
+		  st->filters_size * sizeof *st->filters);
+	}
+	if (st->filters_count > 0 && (f = st->filters
+	  + st->filters_count - 1)->done_ns == 0) {
+		f->done_ns = -1;
+		f->matched = ctx.match_count;
+	}
+	f = st->filters + st->filters_count++;
+	memset(f, 0, sizeof *f);
+	f->input_len = input_len;
+	clock_gettime(CLOCK_MONOTONIC, &f->start);
+}
+
+/*
+ * Count the time since `t' as spent on the current input, and the `count'
+ * lines as searched for it, and tell if it is all searched.
+ */
+static void
+stats_filter_work(struct timespec const *t, size_t count, int done)
+{
+	struct stats *st = &ctx.stats;
+	struct stats_filter *f;
+
+	if (st->filters_count == 0)
+		return;
+	f = st->filters + st->filters_count - 1;
+	f->scanned += count;
+	if (t == NULL)
+		return;
+	f->work_ns += elapsed_ns(t);
+	if (done && ctx.eof && f->done_ns == 0) {
+		f->done_ns = elapsed_ns(&f->start);
+		f->matched = ctx.match_count;
+	}
+}
+
+/*
+ * Count the time since `t' as spent reading and splitting the input, and
+ * the time since the start as the time to load it once it is all read.
+ */
+static void
+stats_load(struct timespec const *t)
+{
+	ctx.stats.split_ns += elapsed_ns(t);
+	if (ctx.eof && ctx.stats.load_ns == 0)
+		ctx.stats.load_ns = elapsed_ns(&ctx.stats.start);
+}
+
+static void
+stats_frame(struct timespec const *t, int bytes)
+{
+	struct stats *st = &ctx.stats;
+
+	if (st->frames_count == st->frames_size) {
+		st->frames_size = st->frames_size ? st->frames_size * 2 : 256;
+		st->frames = xrealloc(st->frames,
+		  st->frames_size * sizeof *st->frames);
+	}
+	st->frames[st->frames_count].ns = elapsed_ns(t);
+	st->frames[st->frames_count].bytes = bytes;
+	st->frames_count++;
+}
+
+static int
+stats_frame_cmp(void const *a, void const *b)
+{
+	long x = ((struct stats_frame const *)a)->ns;
+	long y = ((struct stats_frame const *)b)->ns;
+
+	return (x > y) - (x < y);
+}
+
+static long
+stats_max_rss(void)
+{
+	struct rusage ru;
+
+	return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+/*
+ * Status line of -S: the last input searched, the last frame drawn and the
+ * peak memory.
+ */
+static int
+stats_status(char *buf, size_t size)
+{
+	struct stats *st = &ctx.stats;
+	struct stats_filter *f = st->filters + st->filters_count - 1;
+	struct stats_frame *fr = st->frames + st->frames_count - 1;
+	int len;
+
+	len = snprintf(buf, size, "load %.0fms  ", st->load_ns / 1e6);
+	if (st->filters_count > 0)
+		len += snprintf(buf + len, size - len, "filter %.1fms %zu  ",
+		  f->work_ns / 1e6, f->scanned);
+	if (st->frames_count > 0)
+		len += snprintf(buf + len, size - len, "draw %.0fus %dB  ",
+		  fr->ns / 1e3, fr->bytes);
+	len += snprintf(buf + len, size - len, "rss %ldM  ",
+	  stats_max_rss() / 1024);
+	return len;
+}
+
+/*
+ * Write the measures of -S to its file as JSON, the frames summed up and
+ * the inputs searched one by one.
+ */
+static void
+stats_dump(void)
+{
+	struct stats *st = &ctx.stats;
+	struct stats_frame *fr = st->frames;
+	size_t count = st->frames_count, bytes = 0;
+	long ns = 0;
+	FILE *fp;
+
+	if ((fp = fopen(opt_stats, "w")) == NULL)
+		die("opening the stats");
+	for (size_t i = 0; i < count; i++)
+		ns += fr[i].ns, bytes += fr[i].bytes;
+	qsort(fr, count, sizeof *fr, stats_frame_cmp);
+
+	fprintf(fp, "{\n\t\"lines\": %zu,\n\t\"bytes\": %zu,\n"
+	  "\t\"duplicates\": %zu,\n", ctx.lines_count, ctx.in.len,
+	  ctx.in.dup_count);
+	fprintf(fp, "\t\"load_ms\": %.3f,\n\t\"split_ms\": %.3f,\n"
+	  "\t\"index_ms\": %.3f,\n", st->load_ns / 1e6, st->split_ns / 1e6,
+	  st->index_ns / 1e6);
+	fprintf(fp, "\t\"index_bytes\": %zu,\n",
+	  ctx.indexed ? index_size(&ctx.index) : 0);
+	fprintf(fp, "\t\"max_rss_kb\": %ld,\n", stats_max_rss());
+	fprintf(fp, "\t\"frames\": %zu,\n\t\"frame_bytes\": %zu,\n"
+	  "\t\"render_ms\": %.3f,\n", count, bytes, ns / 1e6);
+	if (count > 0)
+		fprintf(fp, "\t\"render_p50_us\": %.1f,\n"
+		  "\t\"render_p99_us\": %.1f,\n\t\"render_max_us\": %.1f,\n",
+		  fr[count / 2].ns / 1e3, fr[count * 99 / 100].ns / 1e3,
+		  fr[count - 1].ns / 1e3);
+	fprintf(fp, "\t\"filters\": [");
+	for (size_t i = 0; i < st->filters_count; i++) {
+		struct stats_filter *f = st->filters + i;
+
+		fprintf(fp, "%s\n\t\t{\"input_len\": %zu, \"work_ms\": %.3f"
+		  ", \"done_ms\": %.3f, \"scanned\": %zu, \"matched\": %zu}",
+		  i > 0 ? "," : "", f->input_len, f->work_ns / 1e6,
+		  f->done_ns < 0 ? -1 : f->done_ns / 1e6, f->scanned,
+		  f->matched);
+	}
+	fprintf(fp, "\n\t]\n}\n");
+	if (fclose(fp) == EOF)
+		die("writing the stats");
+}
+
+static void
+do_move(int sign)
+{
+	/* integer overflow will do what we need */
+	for (size_t i = ctx.cur + sign; i < shown_count(); i += sign) {
+		if (!line_is_header(shown_line(i))) {
+			ctx.cur = i;
+			break;
+		}
+		/* only -# has headers, never shown with -f or -H */
+		i = header_skip(i, sign);
+	}
+}
+
+static void
+do_move_end(void)
+{
+	ctx.cur = shown_count();
+	do_move(-1);
+	/* or on the last header if all of the matches are */
+	if (ctx.cur == shown_count() && ctx.cur > 0)
+		ctx.cur--;
+}
+
+static void
+filter_job(void *arg, int job)
+{
+	struct filter_work *w = arg;
+	size_t beg = w->count * job / w->jobs;
+	size_t end = w->count * (job + 1) / w->jobs;
+	uint32_t *dst = w->dst + beg;
+	size_t found = 0;
+
+	for (size_t i = beg; i < end; i++) {
+		uint32_t n = w->src != NULL ? w->src[i] : w->beg + i;
+
+		if (match_line(n, w->tokv, job))
+			dst[found++] = n;
+	}
+	w->found[job] = found;
+}
+
+/*
+ * Append the `count' lines of `src', or from line `beg' onward if it is
+ * NULL, that match `tokv' to the matches, keeping them in order.  The
+ * lines are split across threads if there are enough of them.  As no
+ * part has more matches than lines, each part of `src' gets its matches
+ * written over itself, so `src' can be past the end of the matches.
+ */
+static void
+filter(uint32_t *src, size_t beg, size_t count, struct token *tokv)
+{
+	struct filter_work w = { src, src, beg, count, tokv, 1, {0} };
+
+	if (src == NULL)
+		w.dst = ctx.match_buf + ctx.match_count;
+	if (count / FILTER_CHUNK > 1)
+		w.jobs = count / FILTER_CHUNK;
+	if (w.jobs > opt_jobs)
+		w.jobs = opt_jobs;
+	if (opt_regex)
+		for (int job = 0; job < w.jobs; job++)
+			if (pattern_dfa_prepare(ctx.dfa + job, &ctx.pattern) < 0)
+				die("allocating the pattern");
+
+	if (w.jobs == 1)
+		filter_job(&w, 0);
+	else
+		pool_run(filter_job, &w, w.jobs);
+
+	if (opt_stats != NULL)
+		stats_filter_work(NULL, count, 0);
+	for (int job = 0; job < w.jobs; job++) {
+		memmove(ctx.match_buf + ctx.match_count,
+		  w.dst + count * job / w.jobs,
+		  w.found[job] * sizeof *ctx.match_buf);
+		ctx.match_count += w.found[job];
+	}
+}
+
+/*
+ * Split the first `len' bytes of the input into tokens.
+ */
+static void
+set_tokens(size_t len)
+{
+	struct token *t = ctx.tokv;
+	char *b, *s;
+
+	/* folded as the lines are searched */
+	fold_utf8(ctx.tokbuf, ctx.input, len);
+	ctx.tokbuf[len] = '\0';
+
+	for (b = ctx.tokbuf; (s = strsep(&b, " \t")) != NULL;) {
+		if (*s == '\0')
+			continue;
+		t->s = s;
+		t->len = strlen(s);
+		t->mask = fuzzy_mask(s, t->len);
+		t++;
+	}
+	t->s = NULL;
+}
+
+static int
+is_separator(char const *s, size_t len)
+{
+	return strspn(s, " \t") >= len;
+}
+
+/*
+ * Keep the current matches aside before narrowing them down further.
+ */
+static void
+snapshot_push(void)
+{
+	struct snapshot *snap;
+	size_t words = (ctx.lines_filtered + 63) / 64;
+
+	if (ctx.stack_count == ctx.stack_size) {
+		ctx.stack_size = ctx.stack_size * 2 + 8;
+		ctx.stack = xrealloc(ctx.stack,
+		  ctx.stack_size * sizeof *ctx.stack);
+	}
+	snap = ctx.stack + ctx.stack_count++;
+	snap->input_len = ctx.filter_len;
+	snap->lines_count = ctx.lines_filtered;
+	snap->count = ctx.match_count;
+	snap->buf = NULL;
+	snap->bits = NULL;
+
+	if (words * sizeof *snap->bits < ctx.match_count * sizeof *snap->buf) {
+		snap->bits = xmalloc(words * sizeof *snap->bits);
+		memset(snap->bits, 0, words * sizeof *snap->bits);
+		for (size_t i = 0; i < ctx.match_count; i++) {
+			uint32_t n = ctx.match_buf[i];
+
+			snap->bits[n / 64] |= (uint64_t)1 << n % 64;
+		}
+	} else {
+		snap->buf = xmalloc(ctx.match_count * sizeof *snap->buf + 1);
+		memcpy(snap->buf, ctx.match_buf,
+		  ctx.match_count * sizeof *snap->buf);
+	}
+}
+
+/*
+ * Replace the current matches by the last ones kept aside, or by all lines
+ * if there are none, dropping what was left to narrow down.  All lines are
+ * then filtered again by filter_step(), as for any other input.
+ */
+static void
+snapshot_pop(void)
+{
+	struct snapshot *snap;
+	size_t count;
+
+	ctx.scan_beg = ctx.scan_end = 0;
+	if (ctx.stack_count == 0) {
+		ctx.match_count = 0;
+		ctx.lines_filtered = 0;
+		ctx.filter_len = 0;
+		return;
+	}
+
+	snap = ctx.stack + --ctx.stack_count;
+	if (snap->bits != NULL) {
+		count = 0;
+		for (size_t n = 0; n < snap->lines_count; n++) {
+			uint64_t w = snap->bits[n / 64];
+
+			if (w == 0)
+				n |= 63;
+			else if (w >> n % 64 & 1)
+				ctx.match_buf[count++] = n;
+		}
+		free(snap->bits);
+	} else {
+		memcpy(ctx.match_buf, snap->buf, snap->count * sizeof *snap->buf);
+		free(snap->buf);
+	}
+	ctx.match_count = snap->count;
+	ctx.lines_filtered = snap->lines_count;
+	ctx.filter_len = snap->input_len;
+}
+
+/*
+ * First of the tokens that changed since the input was `len' long.
+ */
+static struct token *
+changed_tokens(size_t len)
+{
+	struct token *t;
+
+	for (t = ctx.tokv; t->s != NULL; t++)
+		if ((size_t)(t->s - ctx.tokbuf) + t->len > len)
+			break;
+	return t;
+}
+
+/*
+ * Score of line `n' with -f: how well it matches, plus how often and how
+ * recently it was selected with -H.
+ */
+static int32_t
+rank_score(uint32_t n)
+{
+	int32_t score = opt_history != NULL ? ctx.history_buf[n] : 0;
+
+	for (struct token *t = ctx.tokv; t->s != NULL; t++)
+		score += fuzzy_score(line_str(n), line_fold(n), ctx.lines_len[n],
+		  t->s, t->len);
+	return score;
+}
+
+static void
+rank_job(void *arg, int job)
+{
+	struct rank_work *w = arg;
+	size_t beg = w->beg + w->count * job / w->jobs;
+	size_t end = w->beg + w->count * (job + 1) / w->jobs;
+
+	for (size_t i = beg; i < end; i++)
+		if (!line_is_header(ctx.match_buf[i]))
+			ctx.score_buf[i] = rank_score(ctx.match_buf[i]);
+}
+
+/*
+ * Match `i' with its score, computed beforehand with -f, and known from
+ * the start with -H alone.
+ */
+static struct rank
+rank_match(size_t i)
+{
+	uint32_t n = ctx.match_buf[i];
+	struct rank r = { opt_fuzzy ? ctx.score_buf[i] : ctx.history_buf[n], n };
+
+	return r;
+}
+
+static int
+rank_better(struct rank const *a, struct rank const *b)
+{
+	return a->score > b->score || (a->score == b->score && a->line < b->line);
+}
+
+static int
+rank_cmp(void const *a, void const *b)
+{
+	return rank_better(a, b) ? -1 : rank_better(b, a);
+}
+
+/*
+ * Keep `r' if it is among the RANK_TOP best matches, in a heap with the
+ * worst of them first.
+ */
+static void
+rank_keep(struct rank r)
+{
+	size_t i, c;
+
+	if (ctx.top_count < RANK_TOP) {
+		for (i = ctx.top_count++; i > 0; i = c) {
+			c = (i - 1) / 2;
+			if (!rank_better(ctx.top + c, &r))
+				break;
+			ctx.top[i] = ctx.top[c];
+		}
+	} else {
+		if (!rank_better(&r, ctx.top))
+			return;
+		for (i = 0; (c = 2 * i + 1) < ctx.top_count; i = c) {
+			if (c + 1 < ctx.top_count
+			  && rank_better(ctx.top + c, ctx.top + c + 1))
+				c++;
+			if (!rank_better(&r, ctx.top + c))
+				break;
+			ctx.top[i] = ctx.top[c];
+		}
+	}
+	ctx.top[i] = r;
+	ctx.view_changed = 1;
+}
+
+static void
+rank_reserve(size_t count)
+{
+	if (count > ctx.view_size) {
+		ctx.view_size = count;
+		ctx.view = xrealloc(ctx.view, count * sizeof *ctx.view);
+	}
+}
+
+/*
+ * Show the best matches, sorted.
+ */
+static void
+rank_view(void)
+{
+	rank_reserve(ctx.top_count);
+	memcpy(ctx.view, ctx.top, ctx.top_count * sizeof *ctx.view);
+	qsort(ctx.view, ctx.top_count, sizeof *ctx.view, rank_cmp);
+	ctx.view_count = ctx.top_count;
+	ctx.view_all = 0;
+}
+
+/*
+ * Score the matches found since the last time, up to `step' of them.
+ */
+static void
+rank_step(size_t step)
+{
+	struct rank_work w = { ctx.ranked, ctx.match_count - ctx.ranked, 1 };
+	int changed = ctx.view_changed;
+
+	if (w.count > step)
+		w.count = step;
+	if (w.count == 0)
+		return;
+	if (w.count / RANK_CHUNK > 1)
+		w.jobs = w.count / RANK_CHUNK;
+	if (w.jobs > opt_jobs)
+		w.jobs = opt_jobs;
+
+	if (opt_fuzzy && w.jobs == 1)
+		rank_job(&w, 0);
+	else if (opt_fuzzy)
+		pool_run(rank_job, &w, w.jobs);
+
+	/* sorted again only if the best ones changed in this step */
+	ctx.view_changed = 0;
+	for (size_t i = w.beg; i < w.beg + w.count; i++) {
+		struct rank r = rank_match(i);
+
+		if (!line_is_header(r.line))
+			rank_keep(r);
+	}
+	ctx.ranked += w.count;
+	if (ctx.view_changed || ctx.view_all)
+		rank_view();
+	ctx.view_changed |= changed;
+}
+
+/*
+ * Forget the scores, for a new input.
+ */
+static void
+rank_reset(void)
+{
+	ctx.ranked = 0;
+	ctx.top_count = 0;
+	ctx.view_count = 0;
+	ctx.view_all = 0;
+	ctx.view_changed = 1;
+}
+
+static int
+filter_pending(void)
+{
+	return ctx.scan_beg < ctx.scan_end || ctx.lines_filtered < ctx.lines_count
+	  || (opt_rank && ctx.ranked < ctx.match_count);
+}
+
+/*
+ * In lazy mode, stop filtering once the page of the selection is full and
+ * the match after it is found, unless all of the matches are needed.
+ */
+static int
+filter_wanted(void)
+{
+	size_t rows = term.winsize.ws_row - 1;
+
+	if (!filter_pending())
+		return 0;
+	if (!opt_lazy || ctx.scan_all || opt_rank)
+		return 1;
+	return ctx.match_count <= ctx.cur - ctx.cur % rows + rows;
+}
+
+/*
+ * Go on with the filtering left to do for the current input: first the
+ * matches left to narrow down, which all come before the lines left to
+ * filter.  Only a few steps are done at once, so that a key typed meanwhile
+ * does not wait for the whole input to be filtered.
+ */
+static void
+filter_step(void)
+{
+	size_t n, step = (size_t)FILTER_STEP * opt_jobs;
+	struct timespec t;
+
+	if (opt_stats != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &t);
+
+	if (opt_lazy && !ctx.scan_all)
+		step = FILTER_LAZY_STEP;
+	if (ctx.scan_beg < ctx.scan_end) {
+		n = ctx.scan_end - ctx.scan_beg;
+		if (n > step)
+			n = step;
+		filter(ctx.match_buf + ctx.scan_beg, 0, n,
+		  changed_tokens(ctx.scan_len));
+		ctx.scan_beg += n;
+	} else if (ctx.lines_filtered < ctx.lines_count) {
+		n = ctx.lines_count - ctx.lines_filtered;
+		if (n > step)
+			n = step;
+		filter(NULL, ctx.lines_filtered, n, ctx.tokv);
+		ctx.lines_filtered += n;
+	}
+	if (opt_rank)
+		rank_step((size_t)RANK_STEP * opt_jobs);
+
+	if (ctx.to_end)
+		do_move_end();
+	else if (ctx.cur == 0 && shown_count() > 0
+	  && line_is_header(shown_line(ctx.cur)))
+		do_move(+1);
+	if (opt_stats != NULL)
+		stats_filter_work(&t, 0, !filter_pending());
+}
+
+/*
+ * Filter until the selected match is known, for the keys that use it:
+ * with -f or -H, until all of the matches are scored.
+ */
+static void
+filter_selection(void)
+{
+	while ((opt_rank || ctx.match_count <= ctx.cur) && filter_pending())
+		filter_step();
+}
+
+/*
+ * Sort all of the matches by score, to scroll past the best ones, if the
+ * selection is to move `n' matches past them.
+ */
+static void
+rank_all(size_t n)
+{
+	size_t count = 0;
+
+	if (!opt_rank || ctx.view_all || ctx.top_count < RANK_TOP
+	  || (ctx.cur < ctx.view_count && n < ctx.view_count - ctx.cur))
+		return;
+	while (filter_pending())
+		filter_step();
+
+	rank_reserve(ctx.match_count);
+	for (size_t i = 0; i < ctx.match_count; i++) {
+		struct rank r = rank_match(i);
+
+		if (!line_is_header(r.line))
+			ctx.view[count++] = r;
+	}
+	qsort(ctx.view, count, sizeof *ctx.view, rank_cmp);
+	ctx.view_count = count;
+	ctx.view_all = 1;
+}
+
+/*
+ * Drop the matches left to narrow down that the index tells can not match
+ * the tokens, before they are checked.
+ */
+static void
+index_candidates(struct token *t)
 {
-	void *ptr;
-
-	ptr = malloc(sz);
-	if (ptr == NULL)
-		die("malloc");
-	return ptr;
+	if (!ctx.indexed)
+		return;
+	for (; t->s != NULL; t++)
+		ctx.scan_end = index_filter(&ctx.index, t->s, t->len,
+		  ctx.match_buf, ctx.scan_end, line_is_header);
 }
 
+/*
+ * Narrow down the matches for the tokens of the `len' bytes of the input.
+ * The matches of every prefix of the input are kept in a stack: removing
+ * characters pops back to the matches of what remains, and adding
+ * characters only narrows down the current matches, checking only the
+ * tokens that changed.  If the matches were still being narrowed down, the
+ * new input narrows down both the matches found so far and those left to
+ * check instead.
+ */
 static void
-do_move(int sign)
+filter_tokens(size_t len)
 {
-	/* integer overflow will do what we need */
-	for (size_t i = ctx.cur + sign; i < ctx.match_count; i += sign) {
-		if (opt_comment == 0 || ctx.match_buf[i][0] != '#') {
-			ctx.cur = i;
+	struct token *t;
+	size_t same;
+
+	for (same = 0; same < len && same < ctx.filter_len; same++)
+		if (ctx.input[same] != ctx.filter_input[same])
 			break;
+
+	if (ctx.filter_len > same && is_separator(ctx.filter_input + same,
+	  ctx.filter_len - same))
+		ctx.filter_len = same;
+
+	while (ctx.filter_len > same)
+		snapshot_pop();
+
+	set_tokens(len);
+	t = changed_tokens(ctx.filter_len);
+	if (ctx.filter_len < len && t->s != NULL) {
+		if (ctx.scan_beg < ctx.scan_end) {
+			memmove(ctx.match_buf + ctx.match_count,
+			  ctx.match_buf + ctx.scan_beg,
+			  (ctx.scan_end - ctx.scan_beg) * sizeof *ctx.match_buf);
+			ctx.scan_end -= ctx.scan_beg - ctx.match_count;
+		} else {
+			if (ctx.filter_len > 0)
+				snapshot_push();
+			ctx.scan_len = ctx.filter_len;
+			ctx.scan_end = ctx.match_count;
 		}
+		ctx.scan_beg = ctx.match_count = 0;
+		index_candidates(changed_tokens(ctx.scan_len));
 	}
+	ctx.filter_len = len;
+	memcpy(ctx.filter_input, ctx.input, len);
+}
+
+/*
+ * With -e, a pattern does not narrow down the matches of its prefixes: every
+ * line is searched again, unless it is not valid, as while it is being
+ * typed, which keeps the matches of the last one that was.
+ */
+static void
+filter_pattern(size_t len)
+{
+	if (pattern_compile(&ctx.pattern, ctx.input, len) < 0)
+		return;
+	ctx.match_count = ctx.scan_beg = ctx.scan_end = 0;
+	ctx.lines_filtered = 0;
 }
 
 /*
- * First split input into token, then match every token independently against
- * every line.  The matching lines fills matches.  Matches are searched inside
- * of `searchv' of size `searchc'
+ * Update the matches after a change of the input.  This only sets the work
+ * up, which filter_step() then does bit by bit.
  */
 static void
-do_filter(char **search_buf, size_t search_count)
+do_filter(void)
 {
-	char **t, *tokv[(sizeof ctx.input + 1) * sizeof(char *)];
-	char *b, buf[sizeof ctx.input];
+	struct timespec ts;
+	size_t len;
 
-	strlcpy(buf, ctx.input, sizeof buf);
+	len = strlen(ctx.input);
+	if (opt_stats != NULL) {
+		stats_filter_begin(len);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+	}
+	if (opt_regex)
+		filter_pattern(len);
+	else
+		filter_tokens(len);
 
-	for (b = buf, t = tokv; (*t = strsep(&b, " \t")) != NULL; t++)
-		continue;
-	*t = NULL;
+	ctx.scan_all = 0;
+	if (opt_rank)
+		rank_reset();
 
-	ctx.cur = ctx.match_count = 0;
-	for (size_t n = 0; n < search_count; n++)
-		if (match_line(search_buf[n], tokv))
-			ctx.match_buf[ctx.match_count++] = search_buf[n];
-	if (opt_comment && ctx.match_buf[ctx.cur][0] == '#')
+	ctx.cur = 0;
+	if (shown_count() > 0 && line_is_header(shown_line(ctx.cur)))
 		do_move(+1);
+	if (opt_stats != NULL)
+		stats_filter_work(&ts, 0, !filter_pending());
 }
 
 static void
@@ -124,46 +1194,65 @@ do_move_page(signed int sign)
 	int rows = term.winsize.ws_row - 1;
 	size_t i = ctx.cur - ctx.cur % rows + rows * sign;
 
-	if (i >= ctx.match_count)
+	if (i >= shown_count())
 		return;
 	ctx.cur = i - 1;
 
 	do_move(+1);
+	/* or on the header if there are only headers from there */
+	if (ctx.cur == i - 1)
+		ctx.cur = i;
 }
 
+/*
+ * Move to the first line of the section of the selection, or of the next
+ * one, found from the positions of the headers.
+ */
 static void
 do_move_header(signed int sign)
 {
+	size_t k;
+	uint32_t n;
+
 	do_move(sign);
 
-	if (opt_comment == 0)
+	if (opt_comment == 0 || opt_rank || ctx.cur >= shown_count())
 		return;
-	for (ctx.cur += sign;; ctx.cur += sign) {
-		char *cur = ctx.match_buf[ctx.cur];
-
-		if (ctx.cur >= ctx.match_count) {
+	n = shown_line(ctx.cur);
+	if (sign > 0) {
+		k = line_bound(ctx.headers, ctx.headers_count, n + 1);
+		ctx.cur = k < ctx.headers_count ? match_pos(ctx.headers[k])
+		  : ctx.match_count;
+		if (ctx.cur == ctx.match_count)
 			ctx.cur--;
-			break;
+	} else {
+		k = line_bound(ctx.headers, ctx.headers_count, n);
+		if (k == 0) {
+			ctx.cur = 0;
+			return;
 		}
-		if (cur[0] == '#')
-			break;
+		ctx.cur = match_pos(ctx.headers[k - 1]);
 	}
 
 	do_move(+1);
 }
 
+/*
+ * Remove the last word, split as the tokens are, which leaves the bytes of
+ * UTF-8 characters whole.
+ */
 static void
 do_remove_word(void)
 {
 	int len, i;
 
 	len = strlen(ctx.input) - 1;
-	for (i = len; i >= 0 && isspace(ctx.input[i]); i--)
+	for (i = len; i >= 0 && is_separator(ctx.input + i, 1); i--)
 		ctx.input[i] = '\0';
 	len = strlen(ctx.input) - 1;
-	for (i = len; i >= 0 && !isspace(ctx.input[i]); i--)
+	for (i = len; i >= 0 && !is_separator(ctx.input + i, 1); i--)
 		ctx.input[i] = '\0';
-	do_filter(ctx.lines_buf, ctx.lines_count);
+	do_filter();
 }
 
 static void
@@ -174,34 +1263,45 @@ do_add_char(char c)
 	len = strlen(ctx.input);
 	if (len + 1 == sizeof ctx.input)
 		return;
-	if (isprint(c)) {
+	/* the bytes of UTF-8 characters included */
+	if (isprint((unsigned char)c) || (unsigned char)c >= 0x80) {
 		ctx.input[len] = c;
 		ctx.input[len + 1] = '\0';
 	}
-	do_filter(ctx.match_buf, ctx.match_count);
+	do_filter();
 }
 
 static void
 do_print_selection(void)
 {
+	uint32_t n;
+
 	if (opt_comment) {
-		char **match = ctx.match_buf + ctx.cur;
+		size_t k;
 
-		while (--match >= ctx.match_buf) {
-			if ((*match)[0] == '#') {
-				fprintf(stdout, "%s", *match + 1);
-				break;
-			}
+		/* the header of the section of the selection */
+		n = ctx.cur < shown_count() ? shown_line(ctx.cur) : 0;
+		k = line_bound(ctx.headers, ctx.headers_count, n);
+		if (k > 0) {
+			n = ctx.headers[k - 1];
+			fwrite(line_str(n) + 1, 1, ctx.lines_len[n] - 1, stdout);
 		}
 		fprintf(stdout, "%c", '\t');
 	}
-	term_raw_off(2);
-	if (ctx.match_count == 0
-	  || (opt_comment && ctx.match_buf[ctx.cur][0] == '#'))
+	if (opt_keys == NULL)
+		term_raw_off(2);
+	if (shown_count() == 0 || line_is_header(shown_line(ctx.cur))) {
 		fprintf(stdout, "%s\n", ctx.input);
-	else
-		fprintf(stdout, "%s\n", ctx.match_buf[ctx.cur]);
-	term_raw_on(2);
+	} else {
+		n = shown_line(ctx.cur);
+		fwrite(line_str(n), 1, ctx.lines_len[n], stdout);
+		fprintf(stdout, "\n");
+		/* failing to save it only makes the next ranking worse */
+		if (opt_history != NULL)
+			history_add(opt_history, line_str(n), ctx.lines_len[n]);
+	}
+	if (opt_keys == NULL)
+		term_raw_on(2);
 }
 
 /*
@@ -209,13 +1309,19 @@ do_print_selection(void)
  * (aka Esc + [).  These last two have values above the range of ASCII.
  */
 static int
-key_action(void)
+key_action(int key)
 {
-	int key;
-
-	key = term_get_key(stderr);
+	ctx.to_end = 0;
 	switch (key) {
+	case -1:
+		return -1;
 	case TERM_KEY_CTRL('Z'):
+		/*
+		 * the shell of a client of -D can only resume the client, and
+		 * nothing would resume keys replayed unattended
+		 */
+		if (ctx.conn != -1 || opt_keys != NULL)
+			break;
 		term_raw_off(2);
 		kill(getpid(), SIGSTOP);
 		term_raw_on(2);
@@ -225,16 +1331,24 @@ key_action(void)
 		return -1;
 	case TERM_KEY_CTRL('U'):
 		ctx.input[0] = '\0';
-		do_filter(ctx.lines_buf, ctx.lines_count);
+		do_filter();
 		break;
 	case TERM_KEY_CTRL('W'):
 		do_remove_word();
 		break;
 	case TERM_KEY_DELETE:
-	case TERM_KEY_BACKSPACE:
-		ctx.input[strlen(ctx.input) - 1] = '\0';
-		do_filter(ctx.lines_buf, ctx.lines_count);
+	case TERM_KEY_BACKSPACE: {
+		size_t len = strlen(ctx.input);
+
+		if (len == 0)
+			break;
+		/* the whole of a UTF-8 character */
+		while (--len > 0 && (ctx.input[len] & 0xc0) == 0x80)
+			continue;
+		ctx.input[len] = '\0';
+		do_filter();
 		break;
+	}
 	case TERM_KEY_ARROW_UP:
 	case TERM_KEY_CTRL('P'):
 		do_move(-1);
@@ -244,6 +1358,7 @@ key_action(void)
 		break;
 	case TERM_KEY_ARROW_DOWN:
 	case TERM_KEY_CTRL('N'):
+		rank_all(1);
 		do_move(+1);
 		break;
 	case TERM_KEY_ALT('n'):
@@ -255,16 +1370,37 @@ key_action(void)
 		break;
 	case TERM_KEY_PAGE_DOWN:
 	case TERM_KEY_CTRL('V'):
+		rank_all(term.winsize.ws_row);
 		do_move_page(+1);
 		break;
-	case TERM_KEY_TAB:
-		if (ctx.match_count == 0)
+	case TERM_KEY_END:
+	case TERM_KEY_ALT('>'):
+		ctx.scan_all = ctx.to_end = 1;
+		rank_all(SIZE_MAX);
+		do_move_end();
+		break;
+	case TERM_KEY_ALT('='):
+		ctx.scan_all = 1;
+		break;
+	case TERM_KEY_TAB: {
+		uint32_t n;
+		size_t len;
+
+		filter_selection();
+		if (shown_count() == 0)
 			break;
-		strlcpy(ctx.input, ctx.match_buf[ctx.cur], sizeof(ctx.input));
-		do_filter(ctx.match_buf, ctx.match_count);
+		n = shown_line(ctx.cur);
+		len = ctx.lines_len[n];
+		if (len >= sizeof ctx.input)
+			len = sizeof ctx.input - 1;
+		memcpy(ctx.input, line_str(n), len);
+		ctx.input[len] = '\0';
+		do_filter();
 		break;
+	}
 	case TERM_KEY_ENTER:
 	case TERM_KEY_CTRL('M'):
+		filter_selection();
 		do_print_selection();
 		return 0;
 	default:
@@ -274,117 +1410,670 @@ key_action(void)
 	return 1;
 }
 
-static void
-print_line(char *line, int highlight)
+/*
+ * Length of the part of the line drawn in `cols' columns, without the '#'
+ * of a header.
+ */
+static int
+line_cut(uint32_t n, int cols)
 {
-	if (opt_comment && line[0] == '#') {
-		fprintf(stderr, "\n\x1b[1m\r%.*s\x1b[m",
-		  term_at_width(line + 1, term.winsize.ws_col, 0), line + 1);
+	struct cut *cut = ctx.cuts + n % CUT_CACHE;
+	int header = line_is_header(n);
+
+	if (cut->line != n || cut->cols != cols) {
+		cut->line = n;
+		cut->cols = cols;
+		cut->len = term_at_width(line_str(n) + header,
+		  ctx.lines_len[n] - header, cols, 0);
+	}
+	return cut->len;
+}
+
+/*
+ * The fields of -w of line `n', as columns two spaces apart, cut to `cols'
+ * columns, with their length in `len'.
+ */
+static char const *
+line_columns(uint32_t n, int cols, int *len)
+{
+	struct cut *cut = ctx.cuts + n % CUT_CACHE;
+	uint32_t const *v = line_fields(n) + opt_match.count * 2;
+	char const *s = line_str(n);
+	size_t k, need = cols;
+	int pos = 0, next = 0;
+
+	if (cut->row != NULL && cut->line == n && cut->cols == cols
+	  && cut->columns_gen == ctx.columns_gen) {
+		*len = cut->len;
+		return cut->row;
+	}
+	cut->line = n;
+	cut->cols = cols;
+	cut->columns_gen = ctx.columns_gen;
+
+	/* ranges can overlap, and then be copied more than once */
+	for (int r = 0; r < opt_show.count; r++)
+		need += v[r * 2 + 1] - v[r * 2];
+	if (cut->row_size < need) {
+		cut->row_size = need;
+		cut->row = xrealloc(cut->row, cut->row_size);
+	}
+	cut->len = 0;
+	for (int r = 0; r < opt_show.count && pos < cols; r++) {
+		for (; pos < next && pos < cols; pos++)
+			cut->row[cut->len++] = ' ';
+		k = term_at_width(s + v[r * 2], v[r * 2 + 1] - v[r * 2], cols,
+		  pos);
+		memcpy(cut->row + cut->len, s + v[r * 2], k);
+		cut->len += k;
+		pos += term_width(s + v[r * 2], k, pos);
+		next += ctx.columns[r] + 2;
+	}
+	*len = cut->len;
+	return cut->row;
+}
+
+static int
+print_line(int row, uint32_t n, int highlight)
+{
+	char const *line = line_str(n);
+	int len;
+
+	if (opt_show.count > 0 && !line_is_header(n))
+		line = line_columns(n, term.winsize.ws_col, &len);
+	else
+		len = line_cut(n, term.winsize.ws_col);
+
+	if (line_is_header(n)) {
+		return term_frame_printf(row, "\x1b[1m%.*s\x1b[m", len, line + 1);
 	} else if (highlight) {
-		fprintf(stderr, "\n\x1b[47;30m\x1b[K\r%.*s\x1b[m",
-		  term_at_width(line, term.winsize.ws_col, 0), line);
+		return term_frame_printf(row, "\x1b[47;30m\x1b[K%.*s\x1b[m",
+		  len, line);
 	} else {
-		fprintf(stderr, "\n%.*s",
-		  term_at_width(line, term.winsize.ws_col, 0), line);
+		return term_frame_printf(row, "%.*s", len, line);
 	}
 }
 
-static void
+/*
+ * Draw the screen, and return the count of bytes written for it.
+ */
+static int
 do_print_screen(void)
 {
-	char **m;
-	int p, c, cols, rows;
+	struct timespec t;
+	int p, c, cols, rows, len;
 	size_t i;
 
+	if (opt_stats != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &t);
 	cols = term.winsize.ws_col;
 	rows = term.winsize.ws_row - 1; /* -1 to keep one line for user input */
 	p = c = 0;
 	i = ctx.cur - ctx.cur % rows;
-	m = ctx.match_buf + i;
-	fprintf(stderr, "\x1b[2J");
-	while (p < rows && i < ctx.match_count) {
-		print_line(*m, i == ctx.cur);
-		p++, i++, m++;
+	if (term_frame_begin(rows + 1) < 0)
+		die("drawing the screen");
+	while (p < rows && i < shown_count()) {
+		if (print_line(p + 1, shown_line(i), i == ctx.cur) < 0)
+			die("drawing the screen");
+		p++, i++;
 	}
-	fprintf(stderr, "\x1b[H%.*s",
-	  term_at_width(ctx.input, cols, c), ctx.input);
-	fflush(stderr);
+	if (opt_stats != NULL || opt_lazy || !ctx.eof || filter_pending()) {
+		char status[192], *s = status;
+		int stats = 0;
+
+		if (opt_stats != NULL)
+			stats = stats_status(status, 128);
+		len = stats + snprintf(status + stats, sizeof status - stats,
+		  "%zu/%zu%s", ctx.match_count, ctx.lines_count,
+		  !ctx.eof || filter_pending() ? "+" : "");
+		/* the stats only if there is room for them */
+		if (len >= cols)
+			s += stats, len -= stats;
+		if (len < cols) {
+			if (term_frame_printf(0, "\x1b[1;%dH%s\x1b[H",
+			  cols - len + 1, s) < 0)
+				die("drawing the screen");
+			cols -= len + 1;
+		}
+	}
+	if (term_frame_printf(0, "%.*s", term_at_width(ctx.input,
+	  strlen(ctx.input), cols, c), ctx.input) < 0
+	  || (len = term_frame_end(STDERR_FILENO, 0)) < 0)
+		die("drawing the screen");
+	if (opt_stats != NULL)
+		stats_frame(&t, len);
+	return len;
 }
 
 static void
 sig_winch(int sig)
+{
+	int e = errno;
+
+	/* a full pipe already has a size change to read */
+	write(winch_pipe[1], "", 1);
+	errno = e;
+	signal(sig, sig_winch);
+}
+
+/*
+ * Take the new size of the terminal, for the whole screen to be drawn
+ * again.
+ */
+static void
+update_winsize(void)
 {
 	if (ioctl(STDERR_FILENO, TIOCGWINSZ, &term.winsize) == -1)
 		die("ioctl");
-	do_print_screen();
-	signal(sig, sig_winch);
+	term.redraw = 1;
 }
 
 static void
 usage(char const *arg0)
 {
-	fprintf(stderr, "usage: %s [-#] <lines\n", arg0);
+	fprintf(stderr, "usage: %s [-#efilUu] [-C dir] [-D name] [-d delim]"
+	  " [-H history] [-j jobs] [-k keys [-t times]] [-n fields] [-r rate]"
+	  " [-S stats] [-w fields] <lines\n       %s -c name\n", arg0, arg0);
 	exit(1);
 }
 
-static int
-read_stdin(char **buf)
+/*
+ * Split line `n' into the ranges of fields of -n and -w, and widen the
+ * columns of -w to fit it.
+ */
+static void
+update_fields(uint32_t n)
+{
+	uint32_t *v = line_fields(n);
+	char const *s = line_str(n);
+	int w;
+
+	field_spans(&opt_match, opt_delim, s, ctx.lines_len[n], v);
+	v += opt_match.count * 2;
+	field_spans(&opt_show, opt_delim, s, ctx.lines_len[n], v);
+	if (line_is_header(n))
+		return;
+	/* nothing is aligned after the last column */
+	for (int r = 0; r < opt_show.count - 1; r++) {
+		if ((w = term_width(s + v[r * 2], v[r * 2 + 1] - v[r * 2], 0))
+		  > ctx.columns[r]) {
+			ctx.columns[r] = w;
+			ctx.columns_gen++;
+		}
+	}
+}
+
+/*
+ * Score of line `n' for the times it was selected before, the history only
+ * telling which ones were, which is most of the time none of them, at the
+ * cost of one lookup.
+ */
+static int32_t
+rank_history(uint32_t n)
 {
-	size_t len = 0;
+	double count;
+
+	if (line_is_header(n))
+		return 0;
+	count = history_count(&ctx.history, line_str(n), ctx.lines_len[n]);
+	return count > 0 ? RANK_HISTORY * log2(1 + count) + 0.5 : 0;
+}
 
-	assert(*buf == NULL);
+/*
+ * Make the lines read so far available for the interface, to be filtered
+ * by filter_step() with the current input, keep the position of the headers
+ * among them with -#, split them into fields with -n and -w, score them
+ * with -H, and index them once they are all read.
+ */
+static void
+update_lines(void)
+{
+	if (ctx.match_size < ctx.in.lines_size) {
+		ctx.match_size = ctx.in.lines_size;
+		ctx.match_buf = xrealloc(ctx.match_buf,
+		  ctx.match_size * sizeof *ctx.match_buf);
+		if (opt_fuzzy) {
+			ctx.mask_buf = xrealloc(ctx.mask_buf,
+			  ctx.match_size * sizeof *ctx.mask_buf);
+			memset(ctx.mask_buf + ctx.lines_count, 0,
+			  (ctx.match_size - ctx.lines_count)
+			  * sizeof *ctx.mask_buf);
+			ctx.score_buf = xrealloc(ctx.score_buf,
+			  ctx.match_size * sizeof *ctx.score_buf);
+		}
+		if (opt_history != NULL)
+			ctx.history_buf = xrealloc(ctx.history_buf,
+			  ctx.match_size * sizeof *ctx.history_buf);
+		if (opt_match.count > 0 || opt_show.count > 0)
+			ctx.fields = xrealloc(ctx.fields, ctx.match_size
+			  * (opt_match.count + opt_show.count) * 2
+			  * sizeof *ctx.fields);
+	}
+	ctx.buf = ctx.in.buf;
+	ctx.fold = ctx.in.fold != NULL ? ctx.in.fold : ctx.in.buf;
+	ctx.lines_off = ctx.in.offs;
+	ctx.lines_len = ctx.in.lens;
+	ctx.lines_count = ctx.in.lines_count;
 
-	for (int c; (c = fgetc(stdin)) != EOF;) {
-		if (c == '\0') {
-			fprintf(stderr, "iomenu: ignoring '\\0' byte in input\r\n");
+	for (uint32_t n = ctx.headers_lines; opt_comment && n < ctx.lines_count;
+	  n++) {
+		if (!line_is_header(n))
 			continue;
+		if (ctx.headers_count == ctx.headers_size) {
+			ctx.headers_size = ctx.headers_size
+			  ? ctx.headers_size * 2 : 1024;
+			ctx.headers = xrealloc(ctx.headers,
+			  ctx.headers_size * sizeof *ctx.headers);
+		}
+		ctx.headers[ctx.headers_count++] = n;
+	}
+	ctx.headers_lines = ctx.lines_count;
+
+	for (uint32_t n = ctx.fields_lines; ctx.fields != NULL
+	  && n < ctx.lines_count; n++)
+		update_fields(n);
+	ctx.fields_lines = ctx.lines_count;
+
+	for (uint32_t n = ctx.history_lines; opt_history != NULL
+	  && n < ctx.lines_count; n++)
+		ctx.history_buf[n] = rank_history(n);
+	ctx.history_lines = ctx.lines_count;
+
+	if (opt_index && ctx.eof && !ctx.indexed) {
+		struct timespec t;
+
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		if (index_build(&ctx.index, ctx.fold, ctx.lines_off, ctx.lines_len,
+		  ctx.lines_count) < 0)
+			die("indexing the lines");
+		ctx.indexed = 1;
+		ctx.stats.index_ns = elapsed_ns(&t);
+	}
+}
+
+/*
+ * Read what stdin has available without waiting for more, up to a limit
+ * to keep the interface responsive.
+ */
+static void
+read_stdin(void)
+{
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	struct timespec t;
+	int r;
+
+	if (opt_stats != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &t);
+	for (int i = 0; i < 16; i++) {
+		if ((r = input_read(&ctx.in, STDIN_FILENO)) <= 0)
+			break;
+		if (poll(&pfd, 1, 0) <= 0)
+			break;
+	}
+	if (r < 0)
+		die("reading standard input");
+	if (r == 0) {
+		if (input_end(&ctx.in) < 0)
+			die("reading standard input");
+		ctx.eof = 1;
+	}
+	if (opt_stats != NULL)
+		stats_load(&t);
+	/* with -U, a line shown could still be read again later */
+	if (ctx.eof || opt_unique != INPUT_UNIQUE_LAST)
+		update_lines();
+}
+
+/*
+ * Map stdin in memory if it is a regular file, so that all of it is
+ * available at once.  Otherwise it is read as it comes with read_stdin().
+ * With -C, its lines, their index and its folded copy are taken from the
+ * cache if they are there, and saved there otherwise.
+ */
+static void
+map_stdin(void)
+{
+	struct cache cache;
+	struct stat st;
+	struct timespec t;
+	int r, cached = 0;
+
+	if (opt_stats != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &t);
+	if (opt_cache != NULL && fstat(STDIN_FILENO, &st) == 0
+	  && S_ISREG(st.st_mode)
+	  && cache_load(&cache, opt_cache, &st, opt_unique) > 0
+	  && (cached = input_map_lines(&ctx.in, STDIN_FILENO, cache.offs,
+	  cache.lens, cache.lines_count, cache.fold)) == 0)
+		cache_unmap(&cache);
+	if (cached < 0) {
+		die("reading standard input");
+	} else if (cached) {
+		ctx.in.dup_count = cache.dup_count;
+		if (opt_index && cache.index.offs != NULL) {
+			ctx.index = cache.index;
+			ctx.indexed = 1;
 		}
-		*buf = xrealloc(*buf, sizeof *buf + len + 1);
-		(*buf)[len++] = c;
+	} else if ((r = input_map(&ctx.in, STDIN_FILENO)) == 0) {
+		return;
+	} else if (r < 0) {
+		die("reading standard input");
 	}
-	*buf = xrealloc(*buf, sizeof *buf + len + 1);
-	(*buf)[len] = '\0';
+	if (input_end(&ctx.in) < 0)
+		die("reading standard input");
+	ctx.eof = 1;
+	if (opt_stats != NULL)
+		stats_load(&t);
+	update_lines();
+
+	/* failing to save it only makes the next start slower */
+	if (opt_cache != NULL && (!cached || (opt_index
+	  && cache.index.offs == NULL)))
+		cache_save(opt_cache, &st, &ctx.in,
+		  opt_index ? &ctx.index : NULL);
+}
 
+/*
+ * Milliseconds to wait before the next frame can be drawn, with at most
+ * `opt_rate' frames per second.
+ */
+static int
+frame_delay(void)
+{
+	struct timespec now;
+	long ms, period;
+
+	if (opt_rate == 0)
+		return 0;
+	period = 1000 / opt_rate;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - ctx.frame_time.tv_sec) * 1000
+	  + (now.tv_nsec - ctx.frame_time.tv_nsec) / 1000000;
+	if (ms < period)
+		return period - ms;
+	ctx.frame_time = now;
 	return 0;
 }
 
 /*
- * Split a buffer into an array of lines, without allocating memory for every
- * line, but using the input buffer and replacing '\n' by '\0'.
+ * Wait for either keys to handle, more lines from stdin or a new size of the
+ * terminal, and update the screen after them.  All the keys already typed are handled before the
+ * screen is updated, so that a paste or a repeated key costs one frame.
+ * While there is filtering left to do and wanted, only check for them
+ * without waiting, and filter one step at a time otherwise, updating the
+ * screen as long as the page is not full.  The menu of a client of -D ends
+ * when the client is gone.
+ */
+static void
+event_loop(void)
+{
+	struct pollfd pfd[4] = {
+		{ .fd = STDERR_FILENO, .events = POLLIN },
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = ctx.conn, .events = POLLIN },
+		{ .fd = winch_pipe[0], .events = POLLIN },
+	};
+	size_t rows, count;
+	int busy, delay = 0, redraw = 1;
+	char c[64];
+
+	for (;;) {
+		if (redraw && (delay = frame_delay()) == 0) {
+			do_print_screen();
+			redraw = 0;
+		}
+		busy = filter_wanted();
+		pfd[1].fd = ctx.eof ? -1 : STDIN_FILENO;
+		if (poll(pfd, 4, busy ? 0 : redraw ? delay : -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+		if (pfd[2].revents != 0)
+			return;
+		if (pfd[3].revents != 0) {
+			while (read(winch_pipe[0], c, sizeof c) > 0)
+				continue;
+			update_winsize();
+			redraw = 1;
+		}
+		if (!ctx.eof && pfd[1].revents != 0) {
+			read_stdin();
+			redraw = 1;
+		}
+		if (pfd[0].revents != 0) {
+			do {
+				if (key_action(term_get_key(STDERR_FILENO)) <= 0)
+					return;
+			} while (poll(pfd, 1, 0) > 0);
+			if (filter_wanted())
+				filter_step();
+			redraw = 1;
+		} else if (busy) {
+			rows = term.winsize.ws_row - 1;
+			count = shown_count();
+			filter_step();
+			if (count < ctx.cur - ctx.cur % rows + rows
+			  || ctx.view_changed || !filter_wanted())
+				redraw = 1;
+			ctx.view_changed = 0;
+		}
+	}
+}
+
+/*
+ * Size of the screen drawn with -k: the one of stderr if it is a terminal,
+ * or else as given by $LINES and $COLUMNS, or 24x80.
+ */
+static void
+replay_winsize(void)
+{
+	char const *s;
+
+	if (ioctl(STDERR_FILENO, TIOCGWINSZ, &term.winsize) == 0
+	  && term.winsize.ws_row > 1 && term.winsize.ws_col > 0)
+		return;
+	term.winsize.ws_row = (s = getenv("LINES")) ? atoi(s) : 0;
+	term.winsize.ws_col = (s = getenv("COLUMNS")) ? atoi(s) : 0;
+	if (term.winsize.ws_row < 2)
+		term.winsize.ws_row = 24;
+	if (term.winsize.ws_col < 1)
+		term.winsize.ws_col = 80;
+	term.redraw = 1;
+}
+
+/*
+ * Handle the keys of the script of -k one at a time, as typed on the
+ * terminal, but with all the lines filtered after each before the screen is
+ * drawn, so that the same script always does the same work.  With -t, the
+ * time spent filtering and drawing, and the bytes written, are logged for
+ * each key, the first line being for the screen drawn before any key.
+ */
+static void
+replay_loop(void)
+{
+	struct timespec t;
+	FILE *times = NULL;
+	long filter_ns, render_ns;
+	int fd, key = 0, r = 1, len;
+
+	if ((fd = open(opt_keys, O_RDONLY)) == -1)
+		die("opening the keys");
+	if (opt_times != NULL && (times = fopen(opt_times, "w")) == NULL)
+		die("opening the times");
+	while (!ctx.eof)
+		read_stdin();
+	if (times != NULL)
+		fprintf(times, "key\tfilter_ns\trender_ns\tbytes\tmatches"
+		  "\tstack\n");
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (;;) {
+		while (filter_wanted())
+			filter_step();
+		filter_ns = elapsed_ns(&t);
+
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		len = do_print_screen();
+		render_ns = elapsed_ns(&t);
+		if (times != NULL)
+			fprintf(times, "%d\t%ld\t%ld\t%d\t%zu\t%zu\n", key,
+			  filter_ns, render_ns, len, shown_count(),
+			  ctx.stack_count);
+		if (r == 0 || (key = term_get_key(fd)) == -1)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		if ((r = key_action(key)) < 0)
+			break;
+	}
+	close(fd);
+	if (times != NULL && fclose(times) == EOF)
+		die("writing the times");
+}
+
+/*
+ * Run the menu on the terminal of stderr.
+ */
+static void
+menu_loop(void)
+{
+	term_raw_on(2);
+	if (pipe(winch_pipe) == -1
+	  || fcntl(winch_pipe[0], F_SETFL, O_NONBLOCK) == -1
+	  || fcntl(winch_pipe[1], F_SETFL, O_NONBLOCK) == -1)
+		die("pipe");
+	signal(SIGWINCH, sig_winch);
+	update_winsize();
+
+#ifdef __OpenBSD__
+	pledge("stdio tty", NULL);
+#endif
+
+	event_loop();
+
+	term_raw_off(2);
+}
+
+/*
+ * Wait for a client of -c in a process forked with the lines read, without
+ * any thread, and return in it once there is one, with its terminal as
+ * stderr and its stdout as stdout.  A process is always forked in advance,
+ * so that a client does not wait for the fork of a large server.
  */
 static void
-split_lines(char *s)
+serve_loop(char const *name)
 {
-	size_t sz;
+	struct pollfd pfd[2];
+	int sock, ready[2], fds[SERVE_FDS];
+	pid_t pid;
+	char c;
 
-	ctx.lines_count = 0;
+	if ((sock = serve_listen(name)) == -1)
+		die("listening for clients");
+	signal(SIGCHLD, SIG_IGN);
 	for (;;) {
-		sz = (ctx.lines_count + 1) * sizeof s;
-		ctx.lines_buf = xrealloc(ctx.lines_buf, sz);
-		ctx.lines_buf[ctx.lines_count++] = s;
+		if (pipe(ready) == -1)
+			die("pipe");
+		if ((pid = fork()) == -1)
+			die("fork");
+		if (pid == 0)
+			break;
+		close(ready[1]);
+		/* no byte if it could not accept a client */
+		if (serve_recv(ready[0], &c, 1) <= 0)
+			exit(1);
+		close(ready[0]);
+	}
 
-		s = strchr(s, '\n');
-		if (s == NULL)
+	close(ready[0]);
+	if (pool_init(opt_jobs) < 0)
+		die("starting threads");
+	/* the write end of the pipe fails once the server is gone */
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ready[1];
+	pfd[1].events = 0;
+	for (;;) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+		if (pfd[1].revents != 0)
+			exit(0);
+		if (pfd[0].revents != 0)
 			break;
-		*s++ = '\0';
 	}
-	sz = ctx.lines_count * sizeof s;
-	ctx.match_buf = xmalloc(sz);
-	memcpy(ctx.match_buf, ctx.lines_buf, sz);
+	ctx.conn = serve_accept(sock, fds);
+	serve_send(ready[1], "", 1);
+	close(ready[1]);
+	close(sock);
+	if (ctx.conn == -1)
+		die("accepting a client");
+
+	if (dup2(fds[0], STDERR_FILENO) == -1
+	  || dup2(fds[1], STDOUT_FILENO) == -1)
+		die("dup2");
+	close(fds[0]);
+	close(fds[1]);
+	pid = getpid();
+	if (serve_send(ctx.conn, &pid, sizeof pid) < 0)
+		die("writing to the client");
+	clock_gettime(CLOCK_MONOTONIC, &ctx.stats.start);
+}
+
+static void
+client_winch(int sig)
+{
+	kill(ctx.server, sig);
+}
+
+/*
+ * Hand the terminal and stdout to the server of -D named `name' for it to
+ * run the menu, and wait for it to be done, passing it the changes of the
+ * size of the terminal.  Return the exit status of the menu.
+ */
+static int
+client_run(char const *name)
+{
+	int fd, fds[SERVE_FDS], r;
+	char c;
+
+	if ((fds[0] = open("/dev/tty", O_RDWR)) == -1) {
+		perror("iomenu: opening /dev/tty");
+		return 1;
+	}
+	fds[1] = STDOUT_FILENO;
+	if ((fd = serve_connect(name, fds)) == -1) {
+		perror("iomenu: connecting to the server");
+		return 1;
+	}
+	close(fds[0]);
+	if (serve_recv(fd, &ctx.server, sizeof ctx.server) <= 0)
+		return 1;
+	signal(SIGWINCH, client_winch);
+	/* one byte once the selection is written, nothing on error */
+	r = serve_recv(fd, &c, 1);
+	return r == 1 ? 0 : 1;
 }
 
 /*
- * Read stdin in a buffer, filling a table of lines, then re-open stdin to
- * /dev/tty for an interactive (raw) session to let the user filter and select
- * one line by searching words within stdin.  This was inspired from dmenu.
+ * Read stdin in a buffer, filling a table of lines, while stderr is re-opened
+ * to /dev/tty for an interactive (raw) session to let the user filter and
+ * select one line by searching words within stdin.  This was inspired from
+ * dmenu.
  */
 int
 main(int argc, char *argv[])
 {
-	char *buf = NULL, *arg0;
+	char *arg0;
 
 	arg0 = *argv;
-	for (int opt; (opt = getopt(argc, argv, "#v")) > 0;) {
+	clock_gettime(CLOCK_MONOTONIC, &ctx.stats.start);
+#ifdef _SC_NPROCESSORS_ONLN
+	opt_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	for (int opt; (opt = getopt(argc, argv, "#C:c:D:d:efH:ij:k:ln:r:S:t:Uuvw:")) > 0;) {
 		switch (opt) {
 		case 'v':
 			fprintf(stdout, "%s\n", VERSION);
@@ -392,36 +2081,141 @@ main(int argc, char *argv[])
 		case '#':
 			opt_comment = 1;
 			break;
+		case 'C':
+			opt_cache = optarg;
+			break;
+		case 'c':
+			opt_client = optarg;
+			break;
+		case 'D':
+			opt_serve = optarg;
+			break;
+		case 'd':
+			if (strlen(optarg) != 1)
+				usage(arg0);
+			opt_delim = (unsigned char)*optarg;
+			break;
+		case 'e':
+			opt_regex = 1;
+			break;
+		case 'f':
+			opt_fuzzy = 1;
+			break;
+		case 'H':
+			opt_history = optarg;
+			break;
+		case 'i':
+			opt_index = 1;
+			break;
+		case 'j':
+			opt_jobs = atoi(optarg);
+			if (opt_jobs < 1)
+				usage(arg0);
+			break;
+		case 'k':
+			opt_keys = optarg;
+			break;
+		case 'l':
+			opt_lazy = 1;
+			break;
+		case 'n':
+			if (field_parse(&opt_match, optarg, 0) < 0)
+				usage(arg0);
+			break;
+		case 'r':
+			opt_rate = atoi(optarg);
+			if (opt_rate < 1 || opt_rate > 1000)
+				usage(arg0);
+			break;
+		case 'S':
+			opt_stats = optarg;
+			break;
+		case 't':
+			opt_times = optarg;
+			break;
+		case 'u':
+			opt_unique = INPUT_UNIQUE_FIRST;
+			break;
+		case 'U':
+			opt_unique = INPUT_UNIQUE_LAST;
+			break;
+		case 'w':
+			if (field_parse(&opt_show, optarg, 1) < 0)
+				usage(arg0);
+			break;
 		default:
 			usage(arg0);
 		}
 	}
 	argc -= optind;
 	argv += optind;
+	if (opt_times != NULL && opt_keys == NULL)
+		usage(arg0);
+	if (opt_serve != NULL && opt_keys != NULL)
+		usage(arg0);
+	if (opt_client != NULL)
+		return client_run(opt_client);
+	ctx.conn = -1;
 
-	read_stdin(&buf);
-	split_lines(buf);
-
-	do_filter(ctx.lines_buf, ctx.lines_count);
-
-	if (!isatty(2))
-		die("file descriptor 2 (stderr)");
+	if (opt_jobs < 1)
+		opt_jobs = 1;
+	if (opt_regex) {
+		/* a pattern has no token for the index to look up */
+		opt_fuzzy = opt_index = 0;
+		if (pattern_compile(&ctx.pattern, "", 0) < 0)
+			die("compiling the pattern");
+	}
+	if (opt_fuzzy)
+		/* the index only finds the lines with a token in one piece */
+		opt_index = 0;
+	if (opt_fuzzy || opt_history != NULL) {
+		opt_rank = 1;
+		ctx.top = xmalloc(RANK_TOP * sizeof *ctx.top);
+	}
+	if (opt_history != NULL && history_load(&ctx.history, opt_history) < 0)
+		die("reading the history");
+	if (opt_jobs > POOL_MAX)
+		opt_jobs = POOL_MAX;
+	/* the threads of -D are started after the fork */
+	if (opt_serve == NULL && pool_init(opt_jobs) < 0)
+		die("starting threads");
+	match_init();
+	if (opt_stats != NULL)
+		stats_filter_begin(0);
 
-	freopen("/dev/tty", "w+", stderr);
-	if (stderr == NULL)
-		die("re-opening standard error read/write");
+	ctx.in.unique = opt_unique;
+	map_stdin();
 
-	term_raw_on(2);
-	sig_winch(SIGWINCH);
+	if (opt_keys != NULL) {
+		replay_winsize();
+		replay_loop();
+	} else if (opt_serve != NULL) {
+		while (!ctx.eof)
+			read_stdin();
+		serve_loop(opt_serve);
+		menu_loop();
+	} else {
+		if (!isatty(2))
+			die("file descriptor 2 (stderr)");
 
-#ifdef __OpenBSD__
-	pledge("stdio tty", NULL);
-#endif
+		freopen("/dev/tty", "w+", stderr);
+		if (stderr == NULL)
+			die("re-opening standard error read/write");
 
-	while (key_action() > 0)
-		do_print_screen();
+		menu_loop();
+	}
+	if (opt_stats != NULL)
+		stats_dump();
 
-	term_raw_off(2);
+	if (ctx.in.nul_count > 0)
+		fprintf(stderr, "iomenu: ignoring %zu '\\0' byte(s) in input\n",
+		  ctx.in.nul_count);
+	if (ctx.in.dup_count > 0)
+		fprintf(stderr, "iomenu: dropped %zu duplicate line(s)\n",
+		  ctx.in.dup_count);
 
+	if (ctx.conn != -1 && (fflush(stdout) == EOF
+	  || serve_send(ctx.conn, "", 1) < 0))
+		die("writing the selection");
 	return 0;
 }
@@ -0,0 +1,256 @@
+#include "match.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MATCH_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Case-insensitive substring search, for ASCII only like tolower(3) in the
+ * "C" locale.  The vectorized variants compare the first and last bytes of
+ * the token against 16 or 32 positions of the string at once, and only
+ * compare the rest of the token where both are found.
+ *
+ * Setting the 0x20 bit of a byte turns an uppercase letter into lowercase,
+ * and only the lowercase and uppercase variants of a letter end up equal to
+ * that letter, so folding is a single OR as long as the byte it is compared
+ * to is a letter.
+ *
+ * With `fold' unset, the same code searches text already folded for a token
+ * already folded, without folding either.
+ */
+
+static uint8_t
+match_fold(uint8_t c)
+{
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static uint8_t
+match_case_bit(uint8_t c)
+{
+	c = match_fold(c);
+	return (c >= 'a' && c <= 'z') ? 0x20 : 0;
+}
+
+/*
+ * Compare the bytes between the first and the last of the token, which are
+ * already known to match.
+ */
+static int
+match_inner(char const *s, char const *tok, size_t toklen, int fold)
+{
+	if (!fold) {
+		for (size_t i = 1; i + 1 < toklen; i++)
+			if (s[i] != tok[i])
+				return 0;
+		return 1;
+	}
+	for (size_t i = 1; i + 1 < toklen; i++)
+		if (match_fold(s[i]) != match_fold(tok[i]))
+			return 0;
+	return 1;
+}
+
+static char const *
+match_scalar(char const *s, size_t len, char const *tok, size_t toklen,
+	int fold)
+{
+	uint8_t first, last;
+
+	if (toklen == 0)
+		return s;
+	if (toklen > len)
+		return NULL;
+
+	first = match_fold(tok[0]);
+	last = match_fold(tok[toklen - 1]);
+	for (char const *end = s + len - toklen; s <= end; s++)
+		if (match_fold(s[0]) == first
+		  && match_fold(s[toklen - 1]) == last
+		  && match_inner(s, tok, toklen, fold))
+			return s;
+	return NULL;
+}
+
+#ifdef MATCH_X86
+
+/*
+ * Check the positions of `s' flagged in `m' for the token.
+ */
+static char const *
+match_candidates(char const *s, unsigned m, char const *tok, size_t toklen,
+	int fold)
+{
+	for (; m != 0; m &= m - 1)
+		if (match_inner(s + __builtin_ctz(m), tok, toklen, fold))
+			return s + __builtin_ctz(m);
+	return NULL;
+}
+
+/*
+ * Flag the 16 positions of `s' where the first and last bytes of the token
+ * are found.
+ */
+static unsigned
+match_mask16(char const *s, size_t toklen, __m128i const v[4])
+{
+	__m128i a, b;
+
+	a = _mm_loadu_si128((__m128i const *)s);
+	b = _mm_loadu_si128((__m128i const *)(s + toklen - 1));
+	a = _mm_cmpeq_epi8(_mm_or_si128(a, v[2]), v[0]);
+	b = _mm_cmpeq_epi8(_mm_or_si128(b, v[3]), v[1]);
+	return _mm_movemask_epi8(_mm_and_si128(a, b));
+}
+
+/*
+ * Search the positions from `i' onward, with one block of 16 overlapping
+ * the positions already searched rather than one byte at a time.
+ */
+static char const *
+match_tail16(char const *s, size_t len, size_t i, char const *tok,
+	size_t toklen, __m128i const v[4], int fold)
+{
+	size_t j;
+	char const *p;
+
+	for (; i + toklen - 1 + 16 <= len; i += 16) {
+		p = match_candidates(s + i, match_mask16(s + i, toklen, v),
+		  tok, toklen, fold);
+		if (p != NULL)
+			return p;
+	}
+	if (i == 0)
+		return match_scalar(s, len, tok, toklen, fold);
+	if (i > len - toklen)
+		return NULL;
+	j = len - toklen + 1 - 16;
+	return match_candidates(s + j,
+	  match_mask16(s + j, toklen, v) & ~0u << (i - j), tok, toklen, fold);
+}
+
+static char const *
+match_sse2(char const *s, size_t len, char const *tok, size_t toklen,
+	int fold)
+{
+	__m128i v[4];
+
+	if (toklen == 0)
+		return s;
+	if (toklen > len)
+		return NULL;
+
+	v[0] = _mm_set1_epi8(match_fold(tok[0]));
+	v[1] = _mm_set1_epi8(match_fold(tok[toklen - 1]));
+	v[2] = _mm_set1_epi8(fold ? match_case_bit(tok[0]) : 0);
+	v[3] = _mm_set1_epi8(fold ? match_case_bit(tok[toklen - 1]) : 0);
+	return match_tail16(s, len, 0, tok, toklen, v, fold);
+}
+
+/*
+ * Same as match_sse2() with 32 bytes at once, then finishing with blocks
+ * of 16 bytes.
+ */
+__attribute__((target("avx2")))
+static char const *
+match_avx2(char const *s, size_t len, char const *tok, size_t toklen,
+	int fold)
+{
+	__m256i first, last, first_bit, last_bit, a, b;
+	__m128i v[4];
+	size_t i;
+	char const *p;
+
+	if (toklen == 0)
+		return s;
+	if (toklen > len)
+		return NULL;
+
+	first = _mm256_set1_epi8(match_fold(tok[0]));
+	last = _mm256_set1_epi8(match_fold(tok[toklen - 1]));
+	first_bit = _mm256_set1_epi8(fold ? match_case_bit(tok[0]) : 0);
+	last_bit = _mm256_set1_epi8(fold ? match_case_bit(tok[toklen - 1]) : 0);
+
+	for (i = 0; i + toklen - 1 + 32 <= len; i += 32) {
+		a = _mm256_loadu_si256((__m256i const *)(s + i));
+		b = _mm256_loadu_si256((__m256i const *)(s + i + toklen - 1));
+		a = _mm256_cmpeq_epi8(_mm256_or_si256(a, first_bit), first);
+		b = _mm256_cmpeq_epi8(_mm256_or_si256(b, last_bit), last);
+		p = match_candidates(s + i,
+		  _mm256_movemask_epi8(_mm256_and_si256(a, b)), tok, toklen,
+		  fold);
+		if (p != NULL)
+			return p;
+	}
+
+	v[0] = _mm256_castsi256_si128(first);
+	v[1] = _mm256_castsi256_si128(last);
+	v[2] = _mm256_castsi256_si128(first_bit);
+	v[3] = _mm256_castsi256_si128(last_bit);
+	_mm256_zeroupper();
+	return match_tail16(s, len, i, tok, toklen, v, fold);
+}
+
+#endif
+
+static char const *(*match_fn)(char const *, size_t, char const *, size_t,
+  int) = match_scalar;
+
+/*
+ * Use the variant `i' of those the CPU supports, the slowest first, and
+ * return its name, or NULL if there are not that many, for them to be
+ * compared to each other.
+ */
+char const *
+match_use(int i)
+{
+	switch (i) {
+	case 0:
+		match_fn = match_scalar;
+		return "scalar";
+#ifdef MATCH_X86
+	case 1:
+		match_fn = match_sse2;
+		return "sse2";
+	case 2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			return NULL;
+		match_fn = match_avx2;
+		return "avx2";
+#endif
+	}
+	return NULL;
+}
+
+/*
+ * Pick the fastest variant the CPU supports, before any thread searches.
+ */
+void
+match_init(void)
+{
+	for (int i = 1; match_use(i) != NULL; i++)
+		continue;
+}
+
+/*
+ * Like strcasestr(), but for a string `s' bounded by `len' rather than
+ * terminated by '\0', as the lines are not.
+ */
+char const *
+match_memcasemem(char const *s, size_t len, char const *tok, size_t toklen)
+{
+	return match_fn(s, len, tok, toklen, 1);
+}
+
+/*
+ * Like memmem(), for text and token both already folded to lowercase.
+ */
+char const *
+match_memmem(char const *s, size_t len, char const *tok, size_t toklen)
+{
+	return match_fn(s, len, tok, toklen, 0);
+}
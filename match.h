@@ -0,0 +1,13 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+
+void		 match_init(void);
+char const	*match_use(int i);
+char const	*match_memcasemem(char const *s, size_t len, char const *tok,
+		  size_t toklen);
+char const	*match_memmem(char const *s, size_t len, char const *tok,
+		  size_t toklen);
+
+#endif
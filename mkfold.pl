@@ -0,0 +1,71 @@
+#!/usr/bin/env perl
+#
+# Generate foldtab.h, the simple case folding table of fold.c, from the
+# Unicode data of perl:
+#
+#	perl mkfold.pl >foldtab.h
+#
+# Characters whose folded form has a UTF-8 encoding of another length are
+# left out, for the folded text to keep the offsets of the original.
+
+use strict;
+use warnings;
+use Unicode::UCD qw(casefold);
+
+my $BITS = 6;
+
+sub utf8_len {
+	my $c = shift;
+	return $c < 0x80 ? 1 : $c < 0x800 ? 2 : $c < 0x10000 ? 3 : 4;
+}
+
+my %map;
+for my $c (0 .. 0x10FFFF) {
+	my $f = casefold($c) or next;
+	next if $f->{simple} eq '';
+	my $s = hex($f->{simple});
+	$map{$c} = $s if utf8_len($c) == utf8_len($s);
+}
+
+my $max = (sort { $b <=> $a } keys %map)[0];
+my (%delta, @delta, %block, @block, @stage1);
+for my $b (0 .. $max >> $BITS) {
+	my @d;
+	for my $c ($b << $BITS .. (($b + 1) << $BITS) - 1) {
+		my $d = exists $map{$c} ? $map{$c} - $c : 0;
+		if (!exists $delta{$d}) {
+			$delta{$d} = @delta;
+			push @delta, $d;
+		}
+		push @d, $delta{$d};
+	}
+	my $k = join ',', @d;
+	if (!exists $block{$k}) {
+		$block{$k} = @block;
+		push @block, [@d];
+	}
+	push @stage1, $block{$k};
+}
+die "too many blocks or deltas" if @block > 256 || @delta > 256;
+
+sub list {
+	my ($fmt, $per, @v) = @_;
+	my $s = '';
+	while (my @l = splice @v, 0, $per) {
+		$s .= "\t" . join(', ', map { sprintf $fmt, $_ } @l) . ",\n";
+	}
+	return $s;
+}
+
+printf "/* generated by mkfold.pl from Unicode %s */\n\n",
+  Unicode::UCD::UnicodeVersion();
+printf "#define FOLD_BITS %d\n", $BITS;
+printf "#define FOLD_MAX 0x%X\n\n", $max;
+printf "static int32_t const fold_delta[%d] = {\n%s};\n\n", scalar @delta,
+  list('%d', 8, @delta);
+printf "static uint8_t const fold_stage1[%d] = {\n%s};\n\n", scalar @stage1,
+  list('%d', 16, @stage1);
+printf "static uint8_t const fold_stage2[%d][%d] = {\n", scalar @block,
+  1 << $BITS;
+printf "\t{\n%s\t},\n", list('%d', 16, @$_) =~ s/^\t/\t\t/mgr for @block;
+print "};\n";
@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+
+/*
+ * Generate widthtab.h, the table of the display width of the codepoints
+ * used by term.c, from mk_wcwidth_cjk(), at build time:
+ *
+ *	./mkwidth >widthtab.h
+ *
+ * The width of a codepoint is in 2 bits, 3 standing for -1, and the
+ * codepoints are in blocks of 2^WIDTH_BITS, each stored once, with a first
+ * table telling which block has the widths of the codepoints with these
+ * high bits.
+ */
+
+#define WIDTH_BITS 8
+#define WIDTH_BLOCK (1 << WIDTH_BITS)
+#define WIDTH_MAX 0x10ffff
+#define WIDTH_BLOCKS ((WIDTH_MAX >> WIDTH_BITS) + 1)
+
+static uint8_t blocks[WIDTH_BLOCKS][WIDTH_BLOCK / 4];
+static unsigned stage1[WIDTH_BLOCKS];
+
+int
+main(void)
+{
+	size_t count = 0;
+
+	for (uint32_t b = 0; b < WIDTH_BLOCKS; b++) {
+		uint8_t block[WIDTH_BLOCK / 4] = {0};
+		size_t i;
+
+		for (uint32_t c = 0; c < WIDTH_BLOCK; c++) {
+			int w = mk_wcwidth_cjk((b << WIDTH_BITS) + c);
+
+			block[c / 4] |= (w < 0 ? 3 : w) << (c % 4 * 2);
+		}
+		for (i = 0; i < count; i++)
+			if (memcmp(blocks[i], block, sizeof block) == 0)
+				break;
+		if (i == count)
+			memcpy(blocks[count++], block, sizeof block);
+		stage1[b] = i;
+	}
+	if (count > 256) {
+		fprintf(stderr, "mkwidth: %zu blocks, too many\n", count);
+		return 1;
+	}
+
+	printf("/* generated by mkwidth from mk_wcwidth_cjk() */\n\n");
+	printf("#define WIDTH_BITS %d\n", WIDTH_BITS);
+	printf("#define WIDTH_MAX 0x%X\n\n", WIDTH_MAX);
+	printf("static uint8_t const width_stage1[%d] = {", WIDTH_BLOCKS);
+	for (size_t b = 0; b < WIDTH_BLOCKS; b++)
+		printf("%s%u,", b % 16 ? " " : "\n\t", stage1[b]);
+	printf("\n};\n\n");
+	printf("static uint8_t const width_stage2[%zu][%d] = {\n", count,
+	  WIDTH_BLOCK / 4);
+	for (size_t i = 0; i < count; i++) {
+		printf("\t{");
+		for (size_t j = 0; j < WIDTH_BLOCK / 4; j++)
+			printf("%s0x%02X,", j % 12 ? " " : "\n\t\t", blocks[i][j]);
+		printf("\n\t},\n");
+	}
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,1041 @@
+#include "pattern.h"
+#include <stddef.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fold.h"
+#include "match.h"
+
+/*
+ * Regular expressions, in the syntax of grep -E: searched in lines folded
+ * with fold_utf8(), with the pattern folded the same way, so that they
+ * match regardless of case.
+ *
+ * The pattern is parsed to a tree, compiled to a NFA over bytes, where a
+ * character of several bytes is a sequence of nodes, then run as a DFA whose
+ * states are built the first time they are reached and kept for the next
+ * lines: each line costs one pass over its bytes whatever the pattern, with
+ * no backtracking.  The DFA is capped in size, and started over from the
+ * current state once full.
+ *
+ * A match may start anywhere in the line: the start of the NFA is added
+ * back to every state.  The lines without the longest literal that every
+ * match has are dropped with match_memmem() first, and if every match
+ * starts with the same literal, the others are only run from its first
+ * occurrence.
+ */
+
+enum {
+	AST_SET, AST_CAT, AST_ALT, AST_REPEAT, AST_BOL, AST_EOL, AST_EMPTY,
+};
+
+enum {
+	NFA_SET, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH,
+};
+
+#define PATTERN_DEPTH_MAX 256
+#define PATTERN_REPEAT_MAX 1000
+
+/*
+ * A node of the tree, with the count of NFA nodes it compiles to, or more,
+ * to reject the patterns too large before compiling them.
+ */
+struct pattern_ast {
+	uint8_t type;
+	int a, b;
+	int min, max;
+	long size;
+	uint8_t set[32];
+};
+
+struct pattern_parse {
+	char const *s, *end;
+	struct pattern_ast *ast;
+	int count, size, depth;
+};
+
+static void
+set_add(uint8_t *set, int c)
+{
+	set[c >> 3] |= 1 << (c & 7);
+}
+
+static int
+set_has(uint8_t const *set, int c)
+{
+	return set[c >> 3] >> (c & 7) & 1;
+}
+
+static void
+set_range(uint8_t *set, int lo, int hi)
+{
+	for (int c = lo; c <= hi; c++)
+		set_add(set, c);
+}
+
+static int
+ast_new(struct pattern_parse *ps, int type)
+{
+	struct pattern_ast *new;
+
+	if (ps->count == ps->size) {
+		ps->size = ps->size ? ps->size * 2 : 64;
+		new = realloc(ps->ast, ps->size * sizeof *ps->ast);
+		if (new == NULL)
+			return -1;
+		ps->ast = new;
+	}
+	memset(ps->ast + ps->count, 0, sizeof *ps->ast);
+	ps->ast[ps->count].type = type;
+	ps->ast[ps->count].size = 1;
+	return ps->count++;
+}
+
+static int
+ast_pair(struct pattern_parse *ps, int type, int a, int b)
+{
+	int i;
+
+	if (a < 0 || b < 0 || (i = ast_new(ps, type)) < 0)
+		return -1;
+	ps->ast[i].a = a;
+	ps->ast[i].b = b;
+	ps->ast[i].size = ps->ast[a].size + ps->ast[b].size + 1;
+	if (ps->ast[i].size > PATTERN_NODES_MAX)
+		return -1;
+	return i;
+}
+
+static int
+ast_range(struct pattern_parse *ps, int lo, int hi)
+{
+	int i;
+
+	if ((i = ast_new(ps, AST_SET)) < 0)
+		return -1;
+	set_range(ps->ast[i].set, lo, hi);
+	return i;
+}
+
+/*
+ * Any character of several bytes, as UTF-8.
+ */
+static int
+ast_multibyte(struct pattern_parse *ps)
+{
+	int two, three, four;
+
+	two = ast_pair(ps, AST_CAT, ast_range(ps, 0xc0, 0xdf),
+	  ast_range(ps, 0x80, 0xbf));
+	three = ast_pair(ps, AST_CAT, ast_range(ps, 0xe0, 0xef),
+	  ast_pair(ps, AST_CAT, ast_range(ps, 0x80, 0xbf),
+	  ast_range(ps, 0x80, 0xbf)));
+	four = ast_pair(ps, AST_CAT, ast_range(ps, 0xf0, 0xf7),
+	  ast_pair(ps, AST_CAT, ast_range(ps, 0x80, 0xbf),
+	  ast_pair(ps, AST_CAT, ast_range(ps, 0x80, 0xbf),
+	  ast_range(ps, 0x80, 0xbf))));
+	return ast_pair(ps, AST_ALT, two, ast_pair(ps, AST_ALT, three, four));
+}
+
+/*
+ * Length of the UTF-8 character at `s', or 1 if it is not valid.
+ */
+static size_t
+utf8_len(char const *s, char const *end)
+{
+	uint8_t c = *s;
+	size_t len = c < 0xc0 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : c < 0xf8 ? 4 : 1;
+
+	if ((size_t)(end - s) < len)
+		return 1;
+	for (size_t i = 1; i < len; i++)
+		if ((s[i] & 0xc0) != 0x80)
+			return 1;
+	return len;
+}
+
+/*
+ * The character at `ps->s', as the sequence of its bytes.
+ */
+static int
+ast_char(struct pattern_parse *ps)
+{
+	size_t len = utf8_len(ps->s, ps->end);
+	int i = -1;
+
+	for (size_t k = 0; k < len; k++) {
+		int b = ast_range(ps, (uint8_t)ps->s[k], (uint8_t)ps->s[k]);
+
+		i = k == 0 ? b : ast_pair(ps, AST_CAT, i, b);
+	}
+	ps->s += len;
+	return i;
+}
+
+/*
+ * Add the ASCII characters of the class of `\c' to `set', and tell if it is
+ * one, and if it is negated.
+ */
+static int
+class_escape(uint8_t *set, int c, int *negated)
+{
+	uint8_t tmp[32] = {0};
+
+	switch (c | 0x20) {
+	case 'd':
+		set_range(tmp, '0', '9');
+		break;
+	case 'w':
+		set_range(tmp, '0', '9');
+		set_range(tmp, 'a', 'z');
+		set_range(tmp, 'A', 'Z');
+		set_add(tmp, '_');
+		break;
+	case 's':
+		set_range(tmp, '\t', '\r');
+		set_add(tmp, ' ');
+		break;
+	default:
+		return 0;
+	}
+	*negated = c >= 'A' && c <= 'Z';
+	for (int i = 0; i < 128; i++)
+		if (set_has(tmp, i) != *negated)
+			set_add(set, i);
+	return 1;
+}
+
+/*
+ * Add the ASCII characters of the class `[:name:]' at `s' to `set', and
+ * return its length, or 0 if it is not one.  Patterns match regardless of
+ * case, so upper and lower are both letters.
+ */
+static size_t
+class_name(uint8_t *set, char const *s, char const *end)
+{
+	static struct { char const *name; int (*is)(int); } classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", isalpha }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isalpha }, { "xdigit", isxdigit },
+	};
+
+	for (size_t i = 0; i < sizeof classes / sizeof *classes; i++) {
+		size_t len = strlen(classes[i].name);
+
+		if ((size_t)(end - s) < len + 4 || s[0] != '[' || s[1] != ':'
+		  || memcmp(s + 2, classes[i].name, len) != 0
+		  || s[len + 2] != ':' || s[len + 3] != ']')
+			continue;
+		for (int c = 0; c < 128; c++)
+			if (classes[i].is(c))
+				set_add(set, c);
+		return len + 4;
+	}
+	return 0;
+}
+
+static int
+escape_byte(int c)
+{
+	switch (c) {
+	case 't':
+		return '\t';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	}
+	return c;
+}
+
+/*
+ * A bracket expression: the ASCII characters in a set, and the others in an
+ * alternation of their sequences of bytes.  Ranges and classes such as
+ * `[:alpha:]' are of ASCII characters only, and a negated expression can only list ASCII characters: it matches
+ * every other character, of any length.
+ */
+static int
+parse_class(struct pattern_parse *ps)
+{
+	uint8_t set[32] = {0};
+	int negated = 0, multi = -1, i, neg;
+
+	if (ps->s < ps->end && *ps->s == '^')
+		negated = 1, ps->s++;
+	for (int first = 1;; first = 0) {
+		size_t len;
+		int lo, hi;
+
+		if (ps->s == ps->end)
+			return -1;
+		if (*ps->s == ']' && !first)
+			break;
+		if ((len = class_name(set, ps->s, ps->end)) > 0) {
+			ps->s += len;
+			continue;
+		}
+		if ((uint8_t)*ps->s >= 0x80) {
+			if (negated == 1 || (i = ast_char(ps)) < 0)
+				return -1;
+			multi = multi < 0 ? i : ast_pair(ps, AST_ALT, multi, i);
+			if (ps->s < ps->end && *ps->s == '-' && ps->s + 1 < ps->end
+			  && ps->s[1] != ']')
+				return -1;
+			continue;
+		}
+		lo = (uint8_t)*ps->s++;
+		if (lo == '\\' && ps->s < ps->end) {
+			if (class_escape(set, *ps->s, &neg)) {
+				/* with the characters of several bytes */
+				if (neg && negated)
+					return -1;
+				if (neg)
+					negated = 2;
+				ps->s++;
+				continue;
+			}
+			lo = escape_byte((uint8_t)*ps->s++);
+		}
+		hi = lo;
+		if (ps->end - ps->s >= 2 && *ps->s == '-' && ps->s[1] != ']') {
+			hi = (uint8_t)ps->s[1];
+			ps->s += 2;
+			if (hi == '\\' && ps->s < ps->end)
+				hi = escape_byte((uint8_t)*ps->s++);
+			if (hi >= 0x80 || hi < lo)
+				return -1;
+		}
+		set_range(set, lo, hi);
+	}
+	ps->s++;
+
+	if (negated == 1)
+		for (int c = 0; c < 128; c++)
+			set[c >> 3] ^= 1 << (c & 7);
+	if ((i = ast_new(ps, AST_SET)) < 0)
+		return -1;
+	memcpy(ps->ast[i].set, set, sizeof set);
+	if (negated)
+		multi = ast_multibyte(ps);
+	return multi < 0 ? i : ast_pair(ps, AST_ALT, i, multi);
+}
+
+static int parse_alt(struct pattern_parse *);
+
+static int
+parse_atom(struct pattern_parse *ps)
+{
+	uint8_t set[32] = {0};
+	int i, negated;
+
+	switch (*ps->s) {
+	case '(':
+		ps->s++;
+		if (++ps->depth > PATTERN_DEPTH_MAX)
+			return -1;
+		i = parse_alt(ps);
+		ps->depth--;
+		if (i < 0 || ps->s == ps->end || *ps->s != ')')
+			return -1;
+		ps->s++;
+		return i;
+	case '[':
+		ps->s++;
+		return parse_class(ps);
+	case '.':
+		ps->s++;
+		return ast_pair(ps, AST_ALT, ast_range(ps, 0x00, 0x7f),
+		  ast_multibyte(ps));
+	case '^':
+		ps->s++;
+		return ast_new(ps, AST_BOL);
+	case '$':
+		ps->s++;
+		return ast_new(ps, AST_EOL);
+	case '\\':
+		if (++ps->s == ps->end)
+			return -1;
+		if (class_escape(set, *ps->s, &negated)) {
+			ps->s++;
+			if ((i = ast_new(ps, AST_SET)) < 0)
+				return -1;
+			memcpy(ps->ast[i].set, set, sizeof set);
+			return negated ? ast_pair(ps, AST_ALT, i,
+			  ast_multibyte(ps)) : i;
+		}
+		if ((uint8_t)*ps->s < 0x80) {
+			int c = escape_byte((uint8_t)*ps->s++);
+
+			return ast_range(ps, c, c);
+		}
+		return ast_char(ps);
+	}
+	return ast_char(ps);
+}
+
+/*
+ * Parse the bounds of `{m,n}' after the `{', or return 0 and leave it to be
+ * taken as a literal if it is not one.
+ */
+static int
+parse_bounds(struct pattern_parse *ps, int *min, int *max)
+{
+	char const *s = ps->s;
+
+	*min = 0;
+	if (s == ps->end || *s < '0' || *s > '9')
+		return 0;
+	for (; s < ps->end && *s >= '0' && *s <= '9'; s++)
+		if ((*min = *min * 10 + *s - '0') > PATTERN_REPEAT_MAX)
+			return -1;
+	*max = *min;
+	if (s < ps->end && *s == ',') {
+		*max = -1;
+		if (++s < ps->end && *s >= '0' && *s <= '9') {
+			*max = 0;
+			for (; s < ps->end && *s >= '0' && *s <= '9'; s++)
+				if ((*max = *max * 10 + *s - '0')
+				  > PATTERN_REPEAT_MAX)
+					return -1;
+			if (*max < *min)
+				return -1;
+		}
+	}
+	if (s == ps->end || *s != '}')
+		return 0;
+	ps->s = s + 1;
+	return 1;
+}
+
+static int
+parse_repeat(struct pattern_parse *ps)
+{
+	int i, r, min, max;
+	long size;
+
+	if ((i = parse_atom(ps)) < 0)
+		return -1;
+	while (ps->s < ps->end) {
+		switch (*ps->s++) {
+		case '*':
+			min = 0, max = -1;
+			break;
+		case '+':
+			min = 1, max = -1;
+			break;
+		case '?':
+			min = 0, max = 1;
+			break;
+		case '{':
+			if ((r = parse_bounds(ps, &min, &max)) < 0)
+				return -1;
+			if (r > 0)
+				break;
+			/* FALLTHROUGH */
+		default:
+			ps->s--;
+			return i;
+		}
+		if ((r = ast_new(ps, AST_REPEAT)) < 0)
+			return -1;
+		ps->ast[r].a = i;
+		ps->ast[r].min = min;
+		ps->ast[r].max = max;
+		size = ps->ast[i].size * (max < 0 ? min + 1 : max);
+		ps->ast[r].size = size + (max < 0 ? 1 : max - min) + 1;
+		if (ps->ast[r].size > PATTERN_NODES_MAX)
+			return -1;
+		i = r;
+	}
+	return i;
+}
+
+static int
+parse_cat(struct pattern_parse *ps)
+{
+	int i = -1, r;
+
+	while (ps->s < ps->end && *ps->s != '|' && *ps->s != ')') {
+		/* a repetition of nothing is taken as a literal */
+		if ((*ps->s == '*' || *ps->s == '+' || *ps->s == '?')
+		  && i < 0)
+			r = ast_char(ps);
+		else
+			r = parse_repeat(ps);
+		if (r < 0)
+			return -1;
+		i = i < 0 ? r : ast_pair(ps, AST_CAT, i, r);
+		if (i < 0)
+			return -1;
+	}
+	return i < 0 ? ast_new(ps, AST_EMPTY) : i;
+}
+
+static int
+parse_alt(struct pattern_parse *ps)
+{
+	int i;
+
+	if ((i = parse_cat(ps)) < 0)
+		return -1;
+	while (ps->s < ps->end && *ps->s == '|') {
+		ps->s++;
+		if ((i = ast_pair(ps, AST_ALT, i, parse_cat(ps))) < 0)
+			return -1;
+	}
+	return i;
+}
+
+static int
+nfa_new(struct pattern *p, int type, uint32_t out, uint32_t out1)
+{
+	if (p->count == PATTERN_NODES_MAX)
+		return -1;
+	p->nodes[p->count].type = type;
+	p->nodes[p->count].out = out;
+	p->nodes[p->count].out1 = out1;
+	return p->count++;
+}
+
+/*
+ * Compile the tree from `i' to nodes that go on to `next' once it matched,
+ * and return the first of them.
+ */
+static int
+nfa_emit(struct pattern *p, struct pattern_ast const *ast, int i, int next)
+{
+	struct pattern_ast const *a = ast + i;
+	int n, loop, max, tail;
+
+	if (next < 0)
+		return -1;
+	switch (a->type) {
+	case AST_SET:
+		if (p->sets_count == PATTERN_NODES_MAX
+		  || (n = nfa_new(p, NFA_SET, next, 0)) < 0)
+			return -1;
+		memcpy(p->sets[p->sets_count], a->set, sizeof a->set);
+		p->nodes[n].set = p->sets_count++;
+		return n;
+	case AST_CAT:
+		return nfa_emit(p, ast, a->a, nfa_emit(p, ast, a->b, next));
+	case AST_ALT:
+		n = nfa_emit(p, ast, a->a, next);
+		return n < 0 ? -1 : nfa_new(p, NFA_SPLIT, n,
+		  nfa_emit(p, ast, a->b, next));
+	case AST_BOL:
+		return nfa_new(p, NFA_BOL, next, 0);
+	case AST_EOL:
+		return nfa_new(p, NFA_EOL, next, 0);
+	case AST_EMPTY:
+		return next;
+	}
+
+	/* AST_REPEAT: the optional ones, from the last, then the others */
+	tail = next;
+	if (a->max < 0) {
+		if ((loop = nfa_new(p, NFA_SPLIT, 0, next)) < 0
+		  || (n = nfa_emit(p, ast, a->a, loop)) < 0)
+			return -1;
+		p->nodes[loop].out = n;
+		next = loop;
+		max = a->min;
+	} else {
+		max = a->max;
+	}
+	for (int k = a->min; k < max; k++)
+		if ((n = nfa_emit(p, ast, a->a, next)) < 0
+		  || (next = nfa_new(p, NFA_SPLIT, n, tail)) < 0)
+			return -1;
+	for (int k = 0; k < a->min && next >= 0; k++)
+		next = nfa_emit(p, ast, a->a, next);
+	return next;
+}
+
+/*
+ * The byte of a set of only one, or -1.
+ */
+static int
+set_single(uint8_t const *set)
+{
+	int c = -1;
+
+	for (int k = 0; k < 256; k++) {
+		if (!set_has(set, k))
+			continue;
+		if (c >= 0)
+			return -1;
+		c = k;
+	}
+	return c;
+}
+
+/*
+ * Add the leading single bytes of the sequence from `i' to the literal that
+ * every match starts with, after a `^' if it starts with one, and return 0
+ * once something else is found.
+ */
+static int
+find_prefix(struct pattern *p, struct pattern_ast const *ast, int i)
+{
+	struct pattern_ast const *a = ast + i;
+	int c;
+
+	switch (a->type) {
+	case AST_CAT:
+		return find_prefix(p, ast, a->a) && find_prefix(p, ast, a->b);
+	case AST_EMPTY:
+		return 1;
+	case AST_BOL:
+		if (p->prefix_len > 0 || p->anchored)
+			return 0;
+		p->anchored = 1;
+		return 1;
+	case AST_SET:
+		c = set_single(a->set);
+		if (c < 0 || p->prefix_len == PATTERN_PREFIX_MAX)
+			return 0;
+		p->prefix[p->prefix_len++] = c;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Keep the longest run of single bytes of the sequence from `i' as the
+ * literal that every match has somewhere, with `run' the one going on.
+ */
+static void
+find_must(struct pattern *p, struct pattern_ast const *ast, int i, char *run,
+	size_t *len)
+{
+	struct pattern_ast const *a = ast + i;
+	int c;
+
+	switch (a->type) {
+	case AST_CAT:
+		find_must(p, ast, a->a, run, len);
+		find_must(p, ast, a->b, run, len);
+		return;
+	case AST_EMPTY:
+		return;
+	case AST_SET:
+		if ((c = set_single(a->set)) < 0)
+			break;
+		if (*len < PATTERN_PREFIX_MAX)
+			run[(*len)++] = c;
+		if (*len > p->must_len) {
+			memcpy(p->must, run, *len);
+			p->must_len = *len;
+		}
+		return;
+	}
+	*len = 0;
+}
+
+/*
+ * Number the bytes so that two bytes that are in the same sets get the same
+ * number, for the DFA to only have a transition per number.
+ */
+static void
+find_classes(struct pattern *p)
+{
+	uint8_t edge[32] = {0};
+	int n = 0;
+
+	for (uint32_t i = 0; i < p->sets_count; i++)
+		for (int c = 1; c < 256; c++)
+			if (set_has(p->sets[i], c) != set_has(p->sets[i], c - 1))
+				set_add(edge, c);
+	for (int c = 0; c < 256; c++) {
+		if (c > 0 && set_has(edge, c))
+			n++;
+		p->classes[c] = n;
+	}
+	p->nclasses = n + 1;
+}
+
+/*
+ * Copy the pattern folded as the lines are, but for the escaped bytes.
+ */
+static char *
+fold_pattern(char const *s, size_t len)
+{
+	char *buf;
+	size_t beg = 0;
+
+	if ((buf = malloc(len + 1)) == NULL)
+		return NULL;
+	for (size_t i = 0; i <= len; i++) {
+		if (i < len && s[i] != '\\')
+			continue;
+		fold_utf8(buf + beg, s + beg, i - beg);
+		if (i + 1 < len) {
+			buf[i] = s[i];
+			buf[i + 1] = s[i + 1];
+			i++;
+		} else if (i < len) {
+			buf[i] = s[i];
+		}
+		beg = i + 1;
+	}
+	return buf;
+}
+
+/*
+ * Compile the `len' bytes of `s' into `p', which is left as it was if they
+ * are not a valid pattern, or too large.
+ */
+int
+pattern_compile(struct pattern *p, char const *s, size_t len)
+{
+	struct pattern_parse ps = {0};
+	struct pattern new = {0};
+	char *buf, run[PATTERN_PREFIX_MAX];
+	size_t run_len = 0;
+	int root, start;
+
+	if ((buf = fold_pattern(s, len)) == NULL)
+		return -1;
+	ps.s = buf;
+	ps.end = buf + len;
+	root = parse_alt(&ps);
+	if (root < 0 || ps.s != ps.end)
+		goto err;
+
+	new.nodes = malloc(PATTERN_NODES_MAX * sizeof *new.nodes);
+	new.sets = malloc(PATTERN_NODES_MAX * sizeof *new.sets);
+	if (new.nodes == NULL || new.sets == NULL)
+		goto err;
+	if ((start = nfa_emit(&new, ps.ast, root,
+	  nfa_new(&new, NFA_MATCH, 0, 0))) < 0)
+		goto err;
+	new.start = start;
+	find_prefix(&new, ps.ast, root);
+	find_must(&new, ps.ast, root, run, &run_len);
+	find_classes(&new);
+	new.gen = p->gen + 1;
+
+	pattern_free(p);
+	*p = new;
+	free(ps.ast);
+	free(buf);
+	return 0;
+err:
+	free(new.nodes);
+	free(new.sets);
+	free(ps.ast);
+	free(buf);
+	return -1;
+}
+
+void
+pattern_free(struct pattern *p)
+{
+	free(p->nodes);
+	free(p->sets);
+	p->nodes = NULL;
+	p->sets = NULL;
+}
+
+static void
+dfa_flush(struct pattern_dfa *d)
+{
+	d->count = 0;
+	d->sets_len = 0;
+	d->start = d->start_bol = -1;
+	for (size_t i = 0; i < PATTERN_DFA_HASH; i++)
+		d->hash[i] = -1;
+}
+
+/*
+ * Get the DFA ready for searching lines with `p', empty if it was last
+ * used with another pattern.
+ */
+int
+pattern_dfa_prepare(struct pattern_dfa *d, struct pattern const *p)
+{
+	void *new;
+
+	if (d->gen == p->gen)
+		return 0;
+	if (d->states == NULL) {
+		d->states = malloc(PATTERN_DFA_STATES * sizeof *d->states);
+		d->sets = malloc(PATTERN_DFA_SETS * sizeof *d->sets);
+		d->hash = malloc(PATTERN_DFA_HASH * sizeof *d->hash);
+		d->buf = malloc(PATTERN_NODES_MAX * sizeof *d->buf);
+		d->stack = malloc(PATTERN_NODES_MAX * sizeof *d->stack);
+		d->mark = calloc(PATTERN_NODES_MAX, sizeof *d->mark);
+		if (d->states == NULL || d->sets == NULL || d->hash == NULL
+		  || d->buf == NULL || d->stack == NULL || d->mark == NULL)
+			return -1;
+	}
+	if (d->next == NULL || d->nclasses < p->nclasses) {
+		new = realloc(d->next, (size_t)PATTERN_DFA_STATES
+		  * p->nclasses * sizeof *d->next);
+		if (new == NULL)
+			return -1;
+		d->next = new;
+	}
+	d->nclasses = p->nclasses;
+	d->nodes = p->count;
+	d->gen = p->gen;
+	dfa_flush(d);
+	return 0;
+}
+
+static uint32_t
+dfa_mark_next(struct pattern_dfa *d)
+{
+	if (++d->mark_gen == 0) {
+		memset(d->mark, 0, d->nodes * sizeof *d->mark);
+		d->mark_gen = 1;
+	}
+	return d->mark_gen;
+}
+
+/*
+ * Add to `d->buf' the nodes that consume a byte or end the match reached
+ * from node `n' without consuming any, following `^' if `bol' is set.
+ */
+static size_t
+dfa_closure(struct pattern const *p, struct pattern_dfa *d, uint32_t n,
+	int bol, size_t len)
+{
+	size_t top = 0;
+
+	if (d->mark[n] == d->mark_gen)
+		return len;
+	d->mark[n] = d->mark_gen;
+	d->stack[top++] = n;
+	while (top > 0) {
+		struct pattern_node const *node = p->nodes + d->stack[--top];
+		uint32_t outs[2];
+		int nouts = 0;
+
+		switch (node->type) {
+		case NFA_SPLIT:
+			outs[nouts++] = node->out;
+			outs[nouts++] = node->out1;
+			break;
+		case NFA_BOL:
+			if (bol)
+				outs[nouts++] = node->out;
+			break;
+		default:
+			d->buf[len++] = node - p->nodes;
+		}
+		for (int k = 0; k < nouts; k++) {
+			if (d->mark[outs[k]] == d->mark_gen)
+				continue;
+			d->mark[outs[k]] = d->mark_gen;
+			d->stack[top++] = outs[k];
+		}
+	}
+	return len;
+}
+
+/*
+ * Tell if the nodes of a state reach the end of a match at the end of the
+ * line, through the `$' among them.
+ */
+static int
+dfa_match_end(struct pattern const *p, struct pattern_dfa *d,
+	uint32_t const *set, size_t len, int bol)
+{
+	size_t top = 0;
+
+	dfa_mark_next(d);
+	for (size_t i = 0; i < len; i++) {
+		if (p->nodes[set[i]].type == NFA_EOL) {
+			d->mark[set[i]] = d->mark_gen;
+			d->stack[top++] = set[i];
+		}
+	}
+	while (top > 0) {
+		struct pattern_node const *node = p->nodes + d->stack[--top];
+		uint32_t outs[2];
+		int nouts = 0;
+
+		switch (node->type) {
+		case NFA_MATCH:
+			return 1;
+		case NFA_SPLIT:
+			outs[nouts++] = node->out1;
+			/* FALLTHROUGH */
+		case NFA_EOL:
+			outs[nouts++] = node->out;
+			break;
+		case NFA_BOL:
+			if (bol)
+				outs[nouts++] = node->out;
+			break;
+		}
+		for (int k = 0; k < nouts; k++) {
+			if (d->mark[outs[k]] == d->mark_gen)
+				continue;
+			d->mark[outs[k]] = d->mark_gen;
+			d->stack[top++] = outs[k];
+		}
+	}
+	return 0;
+}
+
+static int
+dfa_cmp(void const *a, void const *b)
+{
+	uint32_t x = *(uint32_t const *)a, y = *(uint32_t const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Find or add the state of the `len' nodes of `d->buf', or return -1 if the
+ * DFA is full.  The state of the start of the line is not shared, as `^'
+ * and `$' can both match there.
+ */
+static int32_t
+dfa_state(struct pattern const *p, struct pattern_dfa *d, size_t len,
+	int bol)
+{
+	struct pattern_state *st;
+	uint32_t h = 2166136261u;
+	size_t slot = 0;
+
+	qsort(d->buf, len, sizeof *d->buf, dfa_cmp);
+	if (!bol) {
+		for (size_t i = 0; i < len; i++)
+			h = (h ^ d->buf[i]) * 16777619u;
+		for (slot = h % PATTERN_DFA_HASH; d->hash[slot] >= 0;
+		  slot = (slot + 1) % PATTERN_DFA_HASH) {
+			st = d->states + d->hash[slot];
+			if (st->len == len && memcmp(d->sets + st->off, d->buf,
+			  len * sizeof *d->buf) == 0)
+				return d->hash[slot];
+		}
+	}
+	if (d->count == PATTERN_DFA_STATES
+	  || d->sets_len + len > PATTERN_DFA_SETS)
+		return -1;
+
+	st = d->states + d->count;
+	st->off = d->sets_len;
+	st->len = len;
+	st->match = 0;
+	memcpy(d->sets + d->sets_len, d->buf, len * sizeof *d->buf);
+	d->sets_len += len;
+	for (size_t i = 0; i < len; i++)
+		if (p->nodes[d->buf[i]].type == NFA_MATCH)
+			st->match = 1;
+	st->dead = len == 0;
+	st->match_end = st->match
+	  || dfa_match_end(p, d, d->sets + st->off, len, bol);
+	for (int c = 0; c < d->nclasses; c++)
+		d->next[d->count * d->nclasses + c] = -1;
+	if (!bol)
+		d->hash[slot] = d->count;
+	return d->count++;
+}
+
+static int32_t
+dfa_start(struct pattern const *p, struct pattern_dfa *d, int bol)
+{
+	int32_t *start = bol ? &d->start_bol : &d->start;
+	size_t len;
+
+	if (*start < 0) {
+		dfa_mark_next(d);
+		len = dfa_closure(p, d, p->start, bol, 0);
+		if ((*start = dfa_state(p, d, len, bol)) < 0) {
+			dfa_flush(d);
+			dfa_mark_next(d);
+			len = dfa_closure(p, d, p->start, bol, 0);
+			*start = dfa_state(p, d, len, bol);
+		}
+	}
+	return *start;
+}
+
+/*
+ * The state after state `from' reads byte `c', with the start of the
+ * pattern added back for the matches starting after it.  The transitions
+ * are kept as the offset of the row of the next state, for pattern_match()
+ * not to multiply on every byte, or as -2 - state for a state that ends the
+ * search, matching or dead, for it to only check for them on a negative one.
+ */
+static int32_t
+dfa_step(struct pattern const *p, struct pattern_dfa *d, int32_t from,
+	uint8_t c)
+{
+	struct pattern_state const *st = d->states + from;
+	int32_t to;
+	size_t len = 0;
+
+	dfa_mark_next(d);
+	for (size_t i = 0; i < st->len; i++) {
+		struct pattern_node const *node = p->nodes + d->sets[st->off + i];
+
+		if (node->type == NFA_SET && set_has(p->sets[node->set], c))
+			len = dfa_closure(p, d, node->out, 0, len);
+	}
+	len = dfa_closure(p, d, p->start, 0, len);
+
+	if ((to = dfa_state(p, d, len, 0)) >= 0) {
+		st = d->states + to;
+		d->next[from * d->nclasses + p->classes[c]] =
+		  st->match || st->dead ? -2 - to : to * d->nclasses;
+		return to;
+	}
+	/* full: start over with only this state, whose nodes are in buf */
+	dfa_flush(d);
+	return dfa_state(p, d, len, 0);
+}
+
+/*
+ * Tell if the `len' bytes of `s', folded, match the pattern anywhere.
+ */
+int
+pattern_match(struct pattern const *p, struct pattern_dfa *d, char const *s,
+	size_t len)
+{
+	struct pattern_state const *st;
+	size_t i = 0;
+	int32_t state, row, to = -1;
+
+	if (p->must_len > p->prefix_len
+	  && match_memmem(s, len, p->must, p->must_len) == NULL)
+		return 0;
+	if (p->anchored) {
+		if (len < p->prefix_len || memcmp(s, p->prefix, p->prefix_len))
+			return 0;
+	} else if (p->prefix_len > 0) {
+		char const *at = match_memmem(s, len, p->prefix, p->prefix_len);
+
+		if (at == NULL)
+			return 0;
+		i = at - s;
+	}
+
+	state = dfa_start(p, d, i == 0);
+	for (;;) {
+		st = d->states + state;
+		if (st->match)
+			return 1;
+		if (st->dead)
+			return 0;
+		row = state * d->nclasses;
+		for (; i < len; i++) {
+			to = d->next[row + p->classes[(uint8_t)s[i]]];
+			if (to < 0)
+				break;
+			row = to;
+		}
+		state = row / d->nclasses;
+		if (i == len)
+			return d->states[state].match_end;
+		state = to == -1 ? dfa_step(p, d, state, s[i]) : -2 - to;
+		i++;
+	}
+}
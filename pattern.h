@@ -0,0 +1,70 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PATTERN_NODES_MAX 8192
+#define PATTERN_PREFIX_MAX 64
+#define PATTERN_DFA_STATES 1024
+#define PATTERN_DFA_SETS (64 * 1024)
+#define PATTERN_DFA_HASH (2 * PATTERN_DFA_STATES)
+
+struct pattern_node {
+	uint8_t type;
+	uint32_t out, out1;
+	uint32_t set;
+};
+
+/*
+ * A regular expression compiled to a NFA of `count' nodes from `start',
+ * with the bytes it tells apart numbered in `classes', the literal that
+ * every match starts with, at the start of the line if `anchored' is set,
+ * and the longest one that every match has.
+ */
+struct pattern {
+	struct pattern_node *nodes;
+	uint8_t (*sets)[32];
+	uint32_t count, sets_count, start;
+	uint8_t classes[256];
+	int nclasses;
+	char prefix[PATTERN_PREFIX_MAX];
+	size_t prefix_len;
+	int anchored;
+	char must[PATTERN_PREFIX_MAX];
+	size_t must_len;
+	uint32_t gen;
+};
+
+struct pattern_state {
+	size_t off;
+	uint32_t len;
+	uint8_t match, match_end, dead;
+};
+
+/*
+ * The DFA of a pattern, built as the lines are searched, each state being
+ * the set of the NFA nodes at `off' in `sets'.  A DFA is only used by one
+ * thread at once.
+ */
+struct pattern_dfa {
+	uint32_t gen;
+	int nclasses;
+	struct pattern_state *states;
+	int32_t *next;
+	size_t count;
+	uint32_t *sets;
+	size_t sets_len;
+	int32_t *hash;
+	uint32_t *buf, *stack, *mark;
+	uint32_t mark_gen, nodes;
+	int32_t start, start_bol;
+};
+
+int	pattern_compile(struct pattern *p, char const *s, size_t len);
+void	pattern_free(struct pattern *p);
+int	pattern_dfa_prepare(struct pattern_dfa *d, struct pattern const *p);
+int	pattern_match(struct pattern const *p, struct pattern_dfa *d,
+		  char const *s, size_t len);
+
+#endif
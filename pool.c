@@ -0,0 +1,96 @@
+#include "pool.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+
+/*
+ * A fixed set of threads waiting for jobs, the calling thread of
+ * pool_run() working on them too.
+ */
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+static void (*pool_fn)(void *, int);
+static void *pool_arg;
+static int pool_jobs, pool_next, pool_pending;
+
+/*
+ * Run jobs until there are none left to start, with the mutex held on
+ * entry and exit.
+ */
+static void
+pool_work(void)
+{
+	void (*fn)(void *, int);
+	void *arg;
+	int job;
+
+	while (pool_next < pool_jobs) {
+		fn = pool_fn;
+		arg = pool_arg;
+		job = pool_next++;
+		pthread_mutex_unlock(&pool_mutex);
+
+		fn(arg, job);
+
+		pthread_mutex_lock(&pool_mutex);
+		if (--pool_pending == 0)
+			pthread_cond_signal(&pool_done);
+	}
+}
+
+static void *
+pool_thread(void *unused)
+{
+	(void)unused;
+
+	pthread_mutex_lock(&pool_mutex);
+	for (;;) {
+		while (pool_next >= pool_jobs)
+			pthread_cond_wait(&pool_wake, &pool_mutex);
+		pool_work();
+	}
+	return NULL;
+}
+
+/*
+ * Start `count' - 1 threads, which get no signal to handle.
+ */
+int
+pool_init(int count)
+{
+	pthread_t thread;
+	sigset_t all, old;
+	int e = 0;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (int i = 1; i < count && e == 0; i++)
+		if ((e = pthread_create(&thread, NULL, pool_thread, NULL)) == 0)
+			pthread_detach(thread);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return e == 0 ? 0 : -1;
+}
+
+/*
+ * Call `fn' with `arg' and every job number from 0 to `jobs' - 1, across
+ * all threads, and wait for all of them to be done.
+ */
+void
+pool_run(void (*fn)(void *, int), void *arg, int jobs)
+{
+	pthread_mutex_lock(&pool_mutex);
+	pool_fn = fn;
+	pool_arg = arg;
+	pool_jobs = jobs;
+	pool_next = 0;
+	pool_pending = jobs;
+	pthread_cond_broadcast(&pool_wake);
+
+	pool_work();
+	while (pool_pending > 0)
+		pthread_cond_wait(&pool_done, &pool_mutex);
+	pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,9 @@
+#ifndef POOL_H
+#define POOL_H
+
+#define POOL_MAX 256
+
+int	pool_init(int count);
+void	pool_run(void (*fn)(void *, int), void *arg, int jobs);
+
+#endif
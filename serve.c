@@ -0,0 +1,222 @@
+#include "serve.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * A Unix socket named after the name given to -D and -c, in a directory
+ * only its owner can enter, through which a client hands its terminal and
+ * its standard output to the process that runs its menu.
+ *
+ * A name with a '/' is the path of the socket itself.
+ */
+
+static int
+serve_path(struct sockaddr_un *sun, char const *name, int make)
+{
+	struct stat st;
+	char dir[PATH_MAX];
+	char const *s;
+	int len;
+
+	memset(sun, 0, sizeof *sun);
+	sun->sun_family = AF_UNIX;
+	if (strchr(name, '/') != NULL) {
+		len = snprintf(sun->sun_path, sizeof sun->sun_path, "%s", name);
+	} else {
+		if ((s = getenv("XDG_RUNTIME_DIR")) != NULL && *s != '\0')
+			len = snprintf(dir, sizeof dir, "%s/iomenu", s);
+		else
+			len = snprintf(dir, sizeof dir, "/tmp/iomenu-%ld",
+			  (long)getuid());
+		if (len < 0 || (size_t)len >= sizeof dir) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		if (make && mkdir(dir, 0700) == -1 && errno != EEXIST)
+			return -1;
+		if (lstat(dir, &st) == -1)
+			return -1;
+		if (!S_ISDIR(st.st_mode) || st.st_uid != getuid()
+		  || (st.st_mode & 077) != 0) {
+			errno = EPERM;
+			return -1;
+		}
+		len = snprintf(sun->sun_path, sizeof sun->sun_path, "%s/%s",
+		  dir, name);
+	}
+	if (len < 0 || (size_t)len >= sizeof sun->sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Listen on the socket of `name', replacing the one of a server that is not
+ * there anymore, and return it, or -1 on error.
+ */
+int
+serve_listen(char const *name)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	int sock, r;
+
+	if (serve_path(&sun, name, 1) < 0)
+		return -1;
+	if (lstat(sun.sun_path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errno = EEXIST;
+			return -1;
+		}
+		if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+			return -1;
+		r = connect(sock, (struct sockaddr *)&sun, sizeof sun);
+		close(sock);
+		if (r == 0) {
+			errno = EADDRINUSE;
+			return -1;
+		}
+		unlink(sun.sun_path);
+	}
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+	if (bind(sock, (struct sockaddr *)&sun, sizeof sun) == -1
+	  || listen(sock, 16) == -1) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/*
+ * Accept a client on `sock', and receive its SERVE_FDS file descriptors in
+ * `fds'.  Return the connection, or -1 on error.
+ */
+int
+serve_accept(int sock, int *fds)
+{
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(SERVE_FDS * sizeof(int))];
+	} ctl;
+	struct msghdr msg;
+	struct cmsghdr *c;
+	struct iovec iov;
+	char byte;
+	int fd;
+
+	while ((fd = accept(sock, NULL, NULL)) == -1)
+		if (errno != EINTR)
+			return -1;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof ctl.buf;
+	if (recvmsg(fd, &msg, 0) != 1)
+		goto err;
+	c = CMSG_FIRSTHDR(&msg);
+	if (c == NULL || c->cmsg_level != SOL_SOCKET
+	  || c->cmsg_type != SCM_RIGHTS
+	  || c->cmsg_len != CMSG_LEN(SERVE_FDS * sizeof(int))) {
+		errno = EPROTO;
+		goto err;
+	}
+	memcpy(fds, CMSG_DATA(c), SERVE_FDS * sizeof(int));
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+/*
+ * Connect to the server of `name' and hand it the SERVE_FDS file
+ * descriptors of `fds'.  Return the connection, or -1 on error.
+ */
+int
+serve_connect(char const *name, int const *fds)
+{
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(SERVE_FDS * sizeof(int))];
+	} ctl;
+	struct sockaddr_un sun;
+	struct msghdr msg;
+	struct cmsghdr *c;
+	struct iovec iov;
+	char byte = 0;
+	int fd;
+
+	if (serve_path(&sun, name, 0) < 0)
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sun, sizeof sun) == -1)
+		goto err;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	memset(&msg, 0, sizeof msg);
+	memset(&ctl, 0, sizeof ctl);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof ctl.buf;
+	c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(SERVE_FDS * sizeof(int));
+	memcpy(CMSG_DATA(c), fds, SERVE_FDS * sizeof(int));
+	if (sendmsg(fd, &msg, 0) != 1)
+		goto err;
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+int
+serve_send(int fd, void const *buf, size_t len)
+{
+	char const *s = buf;
+	ssize_t r;
+
+	for (; len > 0; s += r, len -= r) {
+		if ((r = write(fd, s, len)) == -1) {
+			if (errno != EINTR)
+				return -1;
+			r = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read `len' bytes from `fd', and return 1, or 0 if it is closed before.
+ */
+int
+serve_recv(int fd, void *buf, size_t len)
+{
+	char *s = buf;
+	ssize_t r;
+
+	for (; len > 0; s += r, len -= r) {
+		if ((r = read(fd, s, len)) == -1) {
+			if (errno != EINTR)
+				return -1;
+			r = 0;
+		} else if (r == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
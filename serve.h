@@ -0,0 +1,15 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+
+/* the terminal and the standard output of a client */
+#define SERVE_FDS 2
+
+int	serve_listen(char const *name);
+int	serve_accept(int sock, int *fds);
+int	serve_connect(char const *name, int const *fds);
+int	serve_send(int fd, void const *buf, size_t len);
+int	serve_recv(int fd, void *buf, size_t len);
+
+#endif
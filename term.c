@@ -1,7 +1,10 @@
 #include "term.h"
 #include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <termios.h>
@@ -10,29 +13,107 @@
 
 struct term term;
 
+#include "widthtab.h"
+
+/*
+ * Width of the codepoint as wcwidth(3), from the table generated by
+ * mkwidth.c at build time.
+ */
 static int
 term_codepoint_width(uint32_t codepoint, int pos)
 {
+	int w;
+
 	if (codepoint == '\t')
 		return 8 - pos % 8;
-	return wcwidth(codepoint);
+	if (codepoint > WIDTH_MAX)
+		return -1;
+	w = width_stage2[width_stage1[codepoint >> WIDTH_BITS]]
+	  [(codepoint & ((1 << WIDTH_BITS) - 1)) / 4] >> codepoint % 4 * 2 & 3;
+	return w == 3 ? -1 : w;
+}
+
+/*
+ * Tell if the 8 bytes at `s' are all printable ASCII characters, of width
+ * 1 each, without a branch per byte.
+ */
+static int
+term_ascii8(char const *s)
+{
+	uint64_t const ones = ~(uint64_t)0 / 255;
+	uint64_t x;
+
+	memcpy(&x, s, 8);
+	/* a byte under 0x20 or over 0x7e sets its 0x80 bit in either */
+	return ((x | (x - ones * 0x20) | (x + ones * 0x01)) & ones * 0x80) == 0;
 }
 
+/*
+ * Number of bytes of the `len' of `s' that fit in `width' columns from
+ * column `pos', never cutting a character.  An invalid byte counts as a
+ * character of its own.
+ */
 int
-term_at_width(char const *s, int width, int pos)
+term_at_width(char const *s, size_t len, int width, int pos)
 {
-	char const *beg = s;
+	char const *beg = s, *end = s + len, *c = s;
+	uint32_t state = UTF8_ACCEPT, codepoint;
 
-	for (uint32_t state = 0, codepoint; *s != '\0'; s++) {
-		if (utf8_decode(&state, &codepoint, *s) == UTF8_ACCEPT) {
-			pos += term_codepoint_width(codepoint, pos);
-			if (pos > width)
-				break;
+	while (s < end) {
+		if (s == c && end - s >= 8 && pos + 8 <= width && term_ascii8(s)) {
+			s = c += 8;
+			pos += 8;
+			continue;
+		}
+		switch (utf8_decode(&state, &codepoint, (uint8_t)*s++)) {
+		case UTF8_ACCEPT:
+			break;
+		case UTF8_REJECT:
+			state = UTF8_ACCEPT;
+			codepoint = 0xfffd;
+			break;
+		default:
+			continue;
 		}
+		pos += term_codepoint_width(codepoint, pos);
+		if (pos > width)
+			return c - beg;
+		c = s;
 	}
 	return s - beg;
 }
 
+/*
+ * Number of columns the `len' bytes of `s' take from column `pos'.
+ */
+int
+term_width(char const *s, size_t len, int pos)
+{
+	char const *end = s + len;
+	uint32_t state = UTF8_ACCEPT, codepoint;
+	int beg = pos;
+
+	while (s < end) {
+		if (state == UTF8_ACCEPT && end - s >= 8 && term_ascii8(s)) {
+			s += 8;
+			pos += 8;
+			continue;
+		}
+		switch (utf8_decode(&state, &codepoint, (uint8_t)*s++)) {
+		case UTF8_ACCEPT:
+			break;
+		case UTF8_REJECT:
+			state = UTF8_ACCEPT;
+			codepoint = 0xfffd;
+			break;
+		default:
+			continue;
+		}
+		pos += term_codepoint_width(codepoint, pos);
+	}
+	return pos - beg;
+}
+
 int
 term_raw_on(int fd)
 {
@@ -50,6 +131,7 @@ term_raw_on(int fd)
 	new_termios.c_lflag &= ~(ICANON | ECHO | IEXTEN | IGNBRK | ISIG);
 	if (tcsetattr(fd, TCSANOW, &new_termios) == -1)
 		return -1;
+	term.redraw = 1;
 	return 0;
 }
 
@@ -66,18 +148,30 @@ term_raw_off(int fd)
 	return 0;
 }
 
+static int
+term_getc(int fd)
+{
+	unsigned char c;
+	ssize_t r;
+
+	do {
+		r = read(fd, &c, 1);
+	} while (r == -1 && errno == EINTR);
+	return r == 1 ? c : EOF;
+}
+
 int
-term_get_key(FILE *fp)
+term_get_key(int fd)
 {
 	int key, num;
 
-	key = fgetc(fp);
+	key = term_getc(fd);
 top:
 	switch (key) {
 	case EOF:
 		return -1;
 	case TERM_KEY_ALT('['):
-		key = getc(fp);
+		key = term_getc(fd);
 		if (key == EOF)
 			return -1;
 
@@ -85,7 +179,7 @@ top:
 			num *= 10;
 			num += key - '0';
 
-			key = fgetc(fp);
+			key = term_getc(fd);
 			if (key == EOF)
 				return -1;
 		}
@@ -93,8 +187,19 @@ top:
 		key = TERM_KEY_CSI(key, num);
 
 		goto top;
+	case TERM_KEY_ALT('O'):
+		/* SS3, sent instead of CSI in the application mode of keys */
+		key = term_getc(fd);
+		if (key == EOF)
+			return -1;
+		key = TERM_KEY_CSI(key, 0);
+		goto top;
+	case TERM_KEY_CSI('~', 4):
+	case TERM_KEY_CSI('~', 8):
+		/* End of the vt220 and rxvt */
+		return TERM_KEY_END;
 	case TERM_KEY_ESC:
-		key = getc(fp);
+		key = term_getc(fd);
 		if (key == EOF)
 			return -1;
 		key = TERM_KEY_ALT(key);
@@ -103,3 +208,185 @@ top:
 		return key;
 	}
 }
+
+/*
+ * The screen is drawn one frame at a time: the rows are filled with
+ * term_frame_printf(), then term_frame_end() only sends the rows that
+ * changed since the previous frame, in a single write(), as a synchronized
+ * update for the terminals supporting it to show the frame all at once.
+ */
+
+static int
+term_buf_grow(struct term_buf *b, size_t need)
+{
+	char *new;
+	size_t n;
+
+	if (need <= b->size)
+		return 0;
+	for (n = b->size ? b->size : 256; n < need; n *= 2)
+		continue;
+	if ((new = realloc(b->s, n)) == NULL)
+		return -1;
+	b->s = new;
+	b->size = n;
+	return 0;
+}
+
+static int
+term_buf_add(struct term_buf *b, char const *s, size_t len)
+{
+	if (len == 0)
+		return 0;
+	if (term_buf_grow(b, b->len + len) < 0)
+		return -1;
+	memcpy(b->s + b->len, s, len);
+	b->len += len;
+	return 0;
+}
+
+static int
+term_buf_vprintf(struct term_buf *b, char const *fmt, va_list ap)
+{
+	va_list copy;
+	int len;
+
+	va_copy(copy, ap);
+	len = vsnprintf(b->s + b->len, b->size - b->len, fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return -1;
+	if ((size_t)len >= b->size - b->len) {
+		if (term_buf_grow(b, b->len + len + 1) < 0)
+			return -1;
+		vsnprintf(b->s + b->len, b->size - b->len, fmt, ap);
+	}
+	b->len += len;
+	return 0;
+}
+
+static int
+term_buf_printf(struct term_buf *b, char const *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = term_buf_vprintf(b, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+/*
+ * Start a frame of `rows' empty rows.  The whole screen is drawn again if
+ * its height changed, or if its content is unknown after term_raw_on().
+ */
+int
+term_frame_begin(int rows)
+{
+	if (rows != term.rows_count) {
+		for (int i = rows; i < term.rows_count; i++) {
+			free(term.rows[i].s);
+			free(term.prev[i].s);
+		}
+		if ((term.rows = realloc(term.rows, rows * sizeof *term.rows)) == NULL
+		  || (term.prev = realloc(term.prev, rows * sizeof *term.prev)) == NULL)
+			return -1;
+		for (int i = term.rows_count; i < rows; i++) {
+			memset(term.rows + i, 0, sizeof *term.rows);
+			memset(term.prev + i, 0, sizeof *term.prev);
+		}
+		term.rows_count = rows;
+		term.redraw = 1;
+	}
+	for (int i = 0; i < rows; i++)
+		term.rows[i].len = 0;
+	if (term_buf_grow(&term.out, 1) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Append to the content of a row of the frame, from its first column.
+ */
+int
+term_frame_printf(int row, char const *fmt, ...)
+{
+	struct term_buf *b = term.rows + row;
+	va_list ap;
+	int r;
+
+	if (term_buf_grow(b, 1) < 0)
+		return -1;
+	va_start(ap, fmt);
+	r = term_buf_vprintf(b, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+static int
+term_frame_row(int row)
+{
+	struct term_buf *b = term.rows + row;
+
+	if (term_buf_printf(&term.out, "\x1b[%d;1H\x1b[K", row + 1) < 0)
+		return -1;
+	return term_buf_add(&term.out, b->s, b->len);
+}
+
+static int
+term_row_changed(int row)
+{
+	struct term_buf *b = term.rows + row, *p = term.prev + row;
+
+	return term.redraw || b->len != p->len
+	  || (b->len > 0 && memcmp(b->s, p->s, b->len) != 0);
+}
+
+/*
+ * Send the rows that changed, and return the count of bytes sent.  The row
+ * with the cursor is sent last, if anything is, to leave the cursor at the
+ * end of its content.
+ */
+int
+term_frame_end(int fd, int cursor_row)
+{
+	struct term_buf *swap;
+	int changed = 0;
+	char *s;
+	ssize_t r;
+
+	term.out.len = 0;
+	if (term_buf_printf(&term.out, "\x1b[?2026h") < 0)
+		return -1;
+	for (int i = 0; i < term.rows_count; i++) {
+		if (i == cursor_row || !term_row_changed(i))
+			continue;
+		if (term_frame_row(i) < 0)
+			return -1;
+		changed = 1;
+	}
+	if (changed || term_row_changed(cursor_row)) {
+		if (term_frame_row(cursor_row) < 0)
+			return -1;
+		changed = 1;
+	}
+	if (term_buf_printf(&term.out, "\x1b[?2026l") < 0)
+		return -1;
+
+	swap = term.prev;
+	term.prev = term.rows;
+	term.rows = swap;
+	term.redraw = 0;
+	if (!changed)
+		return 0;
+
+	for (s = term.out.s; s < term.out.s + term.out.len; s += r) {
+		r = write(fd, s, term.out.s + term.out.len - s);
+		if (r == -1 && errno == EINTR)
+			r = 0;
+		else if (r == -1)
+			return -1;
+	}
+	return term.out.len;
+}
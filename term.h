@@ -21,19 +21,34 @@ enum term_key {
 	TERM_KEY_ARROW_DOWN = TERM_KEY_CSI('B', 0),
 	TERM_KEY_PAGE_UP    = TERM_KEY_CSI('~', 5),
 	TERM_KEY_PAGE_DOWN  = TERM_KEY_CSI('~', 6),
+	TERM_KEY_END        = TERM_KEY_CSI('F', 0),
+};
+
+struct term_buf {
+	char *s;
+	size_t len, size;
 };
 
 struct term {
 	struct winsize winsize;
 	struct termios old_termios;
+
+	struct term_buf *rows, *prev;
+	int rows_count;
+	int redraw;
+	struct term_buf out;
 };
 
 extern struct term term;
 
 int	term_width_at_pos(uint32_t codepoint, int pos);
-int	term_at_width(char const *s, int width, int pos);
+int	term_at_width(char const *s, size_t len, int width, int pos);
+int	term_width(char const *s, size_t len, int pos);
 int	term_raw_on(int fd);
 int	term_raw_off(int fd);
-int	term_get_key(FILE *fp);
+int	term_get_key(int fd);
+int	term_frame_begin(int rows);
+int	term_frame_printf(int row, char const *fmt, ...);
+int	term_frame_end(int fd, int cursor_row);
 
 #endif
@@ -24,31 +24,36 @@
  * IN THE SOFTWARE.
  */
 
+/*
+ * Write the UTF-8 encoding of `u' to `dest' unless it is NULL, and return
+ * its length, or 0 if it is not a codepoint.
+ */
 size_t
 utf8_encode(char *dest, uint32_t u)
 {
-	size_t v, n, n2;
+	size_t n;
 
-	if (u <= 0x7f) {
-		if (dest != NULL)
-			*dest = u;
-		return 1;
-	}
-
-	for (v = 0x3f, n = 0; v >= u; ++n)
-		v = (v << 5) | 0x1f;
-	if (v >= 0x7fffffff)
+	if (u <= 0x7f)
+		n = 1;
+	else if (u <= 0x7ff)
+		n = 2;
+	else if (u <= 0xffff)
+		n = 3;
+	else if (u <= 0x10ffff)
+		n = 4;
+	else
 		return 0; /* cannot be encoded */
 
 	if (dest == NULL)
-		return 1 + n;
-
-	*dest++ = (0xff << (7 - n)) | (u >> n * 6);
-	for (n2 = n - 1; n2 ; --n2) {
-		*dest++ = 0x80 | (u & 0x3f);
-		u >>= 6;
+		return n;
+	if (n == 1) {
+		*dest = u;
+		return 1;
 	}
-	return 1 + n;
+	for (size_t i = n - 1; i > 0; i--, u >>= 6)
+		dest[i] = 0x80 | (u & 0x3f);
+	dest[0] = (0xff00 >> n) | u;
+	return n;
 }
 
 /* Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de> *